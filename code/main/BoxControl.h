@@ -36,54 +36,87 @@ class Box {
   public:
     BoxSize size = SMALL;         ///< Default size for testing individual methods.
     Color color = RED;            ///< Default color for testing individual methods.
-    unsigned long elapsedTime;    ///< Time taken during the grab operation.
+    unsigned long elapsedTime;    ///< Time from starting to close the gripper to contact, in ms.
 
-    float GRAB_SPEED = 80;        ///< Speed for grabbing the box.
+    float GRAB_SPEED = 100;       ///< Speed for grabbing the box.
     float RELEASE_SPEED = 80;     ///< Speed for releasing the box.
     float ARM_SPEED = 80;         ///< Speed for major arm motions.
-    float LARGE_BOX_TIME = 700;   ///< Time threshold to differentiate between large and small boxes.
+    int COLOR_SAMPLES = 5;        ///< Gripper color readings voted on while grabbing.
+    int savedColorWindow = 0;     ///< Gripper color window _grab() replaced, put back by _getColor(), 0 if none.
+    float LARGE_BOX_ANGLE = 25;   ///< Gripper angle at contact above which the box is large, in degrees.
+    float contactAngle;           ///< Commanded gripper angle when the jaws touched the box.
 
     /**
      * @brief Method to initiate reaching for the box.
      */
     void _reachFor() {
       Serial.println("= Reaching for box =");
+      startReach();
+      servos.wait();
+    }
+
+    /**
+     * @brief Starts opening the gripper and lowering the arm without blocking.
+     *
+     * Tick the servos group until it is done.
+     */
+    void startReach() {
+      // Open the gripper while the arm comes down
       gripper.speed = 100;
-      gripper.move(100);
+      gripper.setTarget(100);
       arm.speed = 50;
-      arm.move(100);
+      arm.setTarget(100);
     }
 
     /**
      * @brief Method to grab the box.
+     * @param sample_color True to read the gripper color sensor while the jaws close, so
+     * the color vote is already full when they meet the box.
      */
-    void _grab() {
+    void _grab(bool sample_color = false) {
       Serial.println("= Grabbing box =");
       gripper.speed = 100;
       gripper.move(100);
-      gripper.speed = GRAB_SPEED;
 
-      unsigned long startTime = millis(); // Start the timer to sense box size
-      float angle = gripper.current_angle; // Check angle to increment
-      while (!button.getState()) {
-        angle -= 0.1; // Reduce the angle, closing the gripper
-        gripper.move(angle);
-        if (0 >= angle) {
-          break; // Avoid servo damage
+      // Close at full speed. The button interrupt samples the commanded angle the moment
+      // the jaws touch the box, so the loop rate no longer limits the measurement.
+      unsigned long startTime = micros(); // Start the timer to sense box size
+      gripper.speed = GRAB_SPEED;
+      button.armContact(&gripper.current_angle);
+      gripper.setTargetAngle(0);
+      if (sample_color) {
+        // _getColor() votes over these readings, then puts the window back
+        savedColorWindow = gripperColor.moving_average_window;
+        gripperColor.moving_average_window = COLOR_SAMPLES;
+        gripperColor.clearColorHistory();
+      }
+      while (!button.contacted()) {
+        if (gripper.update(millis())) {
+          break; // Fully closed without touching anything
+        }
+        if (sample_color) {
+          gripperColor.getColor();
         }
       }
 
-      unsigned long endTime = millis();
-      elapsedTime = endTime - startTime;
+      if (button.contacted()) {
+        contactAngle = button.contactAngle;
+        elapsedTime = (button.contactTime - startTime) / 1000;
+        gripper.write(contactAngle); // Hold where the jaws met the box
+      } else {
+        contactAngle = gripper.current_angle;
+        elapsedTime = (micros() - startTime) / 1000;
+      }
       Serial.println(elapsedTime);
+      Serial.println(contactAngle);
     }
 
     /**
-     * @brief Method to determine the size of the box based on grip time.
+     * @brief Method to determine the size of the box based on the gripper angle at contact.
      */
     void _getSize() {
       Serial.println("= Getting box size =");
-      size = elapsedTime < LARGE_BOX_TIME ? LARGE : SMALL;
+      size = contactAngle > LARGE_BOX_ANGLE ? LARGE : SMALL;
       Serial.println(size == LARGE ? "Box Size: Large Box" : "Box Size: Small Box");
     }
 
@@ -93,6 +126,10 @@ class Box {
     void _getColor() {
       Serial.println("= Getting box color =");
       color = gripperColor.getColor();
+      if (savedColorWindow > 0) {
+        gripperColor.moving_average_window = savedColorWindow;
+        savedColorWindow = 0;
+      }
       Serial.print("Box Color: ");
       Serial.println(gripperColor.color);
     }
@@ -102,8 +139,18 @@ class Box {
      */
     void _pickup() {
       Serial.println("= Elevating the box =");
+      startPickup();
+      servos.wait();
+    }
+
+    /**
+     * @brief Starts lifting the box without blocking.
+     *
+     * Tick the servos group until it is done.
+     */
+    void startPickup() {
       arm.speed = 100;
-      arm.move(80);
+      arm.setTarget(80);
     }
 
     /**
@@ -16,9 +16,11 @@
 #include "sensors/ColorSensor.h"
 #include "sensors/Motor.h"
 #include "sensors/UltraSonic.h"
+#include "sensors/SonarManager.h"
 #include "sensors/MWServo.h"
 #include "sensors/Button.h"
 #include "sensors/IRSensorArray.h"
+#include "sensors/BatteryMonitor.h"
 #include "controls/PIDController.h"
 #include "controls/Utils.h"
 
@@ -26,14 +28,19 @@
 #define HORIZONTAL_BOT_LENGTH 23.1775
 #define TOP_MOTOR_TO_IR_ARRAY_LENGTH 5.08
 #define BOTTOM_MOTOR_TO_IR_ARRAY_LENGTH 25.4
+#define SONAR_SPACING HORIZONTAL_BOT_LENGTH // Left and right sonars sit on the front corners
 
 extern ColorSensor leftColor, rightColor, gripperColor, middleColor;
 extern Motor topMotor, bottomMotor, leftMotor, rightMotor;
+extern QuadratureEncoder topEncoder, bottomEncoder, leftEncoder, rightEncoder; // Only used once wired
 extern UltraSonic rightSonic, leftSonic, middleSonic;
+extern SonarManager sonarManager;
 extern MWServo arm, gripper;
+extern ServoGroup servos;
 extern Button button;
 extern PIDController pid;
 extern IRSensorArray irArray;
+extern BatteryMonitor battery;
 
 /**
  * Initializes the Infrared Sensor Array with predetermined calibration values.
@@ -57,10 +64,29 @@ void initIRArray() {
   irArray.initialize();
 }
 
+/**
+ * Initializes the battery monitor used to compensate the motor PWM for supply voltage.
+ */
+void initBattery(){
+  // Every ADC pin is taken by the IR array and color sensors on the current harness, so
+  // the divider isn't fitted and setup() doesn't call this. Set the pin once it's wired.
+  battery.pin = -1;
+  battery.divider_ratio = 4.0;
+  battery.nominal_voltage = 12.0;
+  battery.debug = false;
+  battery.initialize();
+}
+
 /**
  * Initializes the motors with specified calibration data and configurations.
  */
 void initMotors(){
+  // Every motor shares the higher resolution, so set it before any analogWrite.
+  analogWriteResolution(MOTOR_PWM_RESOLUTION);
+
+  // Rows are {speed_percent, pwm_percent, speed, voltage}. Rows without a voltage were
+  // measured at battery.nominal_voltage. Tables re-measured at other charge levels can be
+  // appended with their voltage, and the motor switches to the closest one as it drains.
 
   // ==== TOP ====
   // Define calibration data
@@ -142,6 +168,12 @@ void initMotors(){
   rightMotor.setCalibrationData(rightCalibrationData);
   rightMotor.initialize();
 
+  // Wheel encoders are optional. To close the velocity loop on a wheel, wire its encoder
+  // and attach it before that motor's initialize(), e.g.
+  //   topEncoder.pinA = 42; topEncoder.pinB = 43;
+  //   topEncoder.counts_per_cm = 47.3; // 1425.1 counts/rev on a 96 mm omni wheel
+  //   topMotor.encoder = &topEncoder;
+
 }
 
 /**
@@ -180,6 +212,13 @@ void initUltrasonicSensors(){
   middleSonic.soundDelay = 10;
   middleSonic.label = "Middle UltraSonic Sensor";
   middleSonic.initialize();
+
+ // ==== BACKGROUND RANGING ====
+
+  sonarManager.add(leftSonic);
+  sonarManager.add(middleSonic);
+  sonarManager.add(rightSonic);
+  sonarManager.begin();
 }
 
 /**
@@ -205,6 +244,10 @@ void initServos(){
   arm.speed = 80;
   arm.move(80);
 
+  // Lets the arm and gripper move together, and alongside the drive base
+  servos.add(arm);
+  servos.add(gripper);
+
 }
 
 /**
@@ -1,10 +1,12 @@
 /**
  * @file LineFollowing.h
- * @brief This file contains the IRLineFollower class for line following using IR sensors.
+ * @brief This file contains the IRLineFollower and LineTracker classes for line following using IR sensors.
  *
  * This class manages the behavior of a robot equipped with infrared (IR) sensors for
  * following a line on the ground. It includes methods for initializing the robot, processing
  * sensor data, and controlling the motors based on computed errors using a PID controller.
+ * LineTracker follows more precisely by estimating the robot's offset from the line and
+ * its angle to it separately and correcting each with the holonomic base.
  */
 
 #ifndef LINEFOLLOWING_H
@@ -76,6 +78,9 @@ public:
     if (if_catch_lines) {
     if ((leftColor.getColor() == follow_color) || (rightColor.getColor() == follow_color))
     {
+      // The turn is timed with delay(), which the slew limiter can't ramp through
+      bool slew_limited = topMotor.slew_limited;
+      bot.setSlewLimited(false);
       if (leftColor.color == follow_color) {
         bot.turn(LEFT, turn_pwm);
         delay(turn_delay);
@@ -84,6 +89,7 @@ public:
         delay(turn_delay);
       }
       bot.stopMotion();
+      bot.setSlewLimited(slew_limited);
       leftColor.clearColorHistory();
       rightColor.clearColorHistory();
     }
@@ -149,18 +155,176 @@ public:
    */
   void drives() {  
     // Serial.println(error);
-    leftMotor.drive(left_direction, left_pwm);
-    rightMotor.drive(right_direction, right_pwm);
-
-    // Top and bottom motor logic
-    topMotor.drive(top_direction, top_pwm);
-    bottomMotor.drive(bottom_direction, bottom_pwm);
+    bot.apply({
+      {top_direction, top_pwm},
+      {bottom_direction, bottom_pwm},
+      {left_direction, left_pwm},
+      {right_direction, right_pwm}});
   }
 };
 
 // Initialize the IR line follower class
 IRLineFollower irFollower;
 
+/**
+ * @class LineTracker
+ * @brief Follows a line by estimating and correcting its offset and angle separately.
+ *
+ * IRLineFollower turns the IR array error straight into wheel speeds, which mixes up two
+ * things: how far the robot has drifted off the line and how far it is turned from it.
+ * Both move the line under the array, which sits ahead of the robot's centre. This class
+ * keeps an estimate of each, the line's sideways offset at the robot's centre and the
+ * line's angle, with a small Kalman filter. The IR array measures the offset ahead of the
+ * centre (offset - ir_forward * angle), the middle color sensor pins the offset near its
+ * own position whenever it sees the line, and the odometry twist carries both forward
+ * between readings. The holonomic base then strafes out the offset and turns out the
+ * angle as two independent loops through bot.setVelocity().
+ */
+class LineTracker {
+public:
+  cm_per_sec speed = 30;          ///< Forward speed along the line.
+  float offset_gain = 3;          ///< Sideways speed per cm of offset, in 1/sec.
+  float angle_gain = 3;           ///< Turn rate per radian of line angle, in 1/sec.
+  cm_per_sec max_strafe_speed = 20; ///< Fastest sideways correction.
+  float max_turn_rate = 1.5;      ///< Fastest turn correction in rad/sec.
+
+  cm ir_half_width = 2.86;        ///< Distance from the middle to an outer IR sensor (9.5 mm pitch).
+  cm ir_forward = (BOTTOM_MOTOR_TO_IR_ARRAY_LENGTH - TOP_MOTOR_TO_IR_ARRAY_LENGTH) / 2; ///< IR array ahead of the centre.
+  cm middle_forward = 0;          ///< Middle color sensor ahead of the centre, unmeasured.
+  float middle_noise = 3.5;       ///< Standard deviation of the middle sensor's offset reading in cm: half the tape, plus the unmeasured middle_forward.
+  float ir_noise = 0.5;           ///< Standard deviation of the IR offset reading in cm.
+  float offset_noise = 2;         ///< Offset drift from wheel slip in cm per sqrt(sec).
+  float angle_noise = 0.3;        ///< Angle drift from curves in the line in rad per sqrt(sec).
+
+  Color follow_color;             ///< Color of the line being followed.
+  float error = 0;                ///< Last IR array error, -1 to 1.
+  float offset = 0;               ///< Estimated line offset at the centre in cm, positive to the right.
+  float angle = 0;                ///< Estimated line angle in radians, positive when it heads left.
+
+  /**
+   * @brief Forgets the estimate. Call before starting on a line.
+   */
+  void initialize() {
+    offset = 0;
+    angle = 0;
+    p00 = ir_half_width * ir_half_width;
+    p01 = 0;
+    p11 = 0.3 * 0.3;
+    lastTime = millis();
+  }
+
+  /**
+   * @brief Runs one step of line following at the configured speed.
+   * @param followed_color Color of the line to follow.
+   */
+  void follow(Color followed_color) {
+    follow(followed_color, speed);
+  }
+
+  /**
+   * @brief Runs one step of line following.
+   *
+   * The sideways command includes -forward_speed * angle, which cancels the drift that
+   * driving forward along an angled line adds to the offset, so the offset loop doesn't
+   * have to fight the angle loop.
+   * @param followed_color Color of the line to follow.
+   * @param forward_speed Forward speed along the line in cm/sec.
+   */
+  void follow(Color followed_color, cm_per_sec forward_speed) {
+    follow_color = followed_color;
+    Color middle = middleColor.getColor();
+    irArray.setColor((middle == YELLOW) ? YELLOW : follow_color);
+
+    unsigned long now = millis();
+    predict(min((now - lastTime) / 1000.0, 0.1));
+    lastTime = now;
+
+    error = irArray.getError();
+    if (lineSeen()) {
+      // Once the line runs off the end of the array the reading only says which side it's on
+      float noise = (fabs(error) > 0.95) ? ir_half_width : ir_noise;
+      correct(error * ir_half_width, ir_forward, noise);
+    }
+    if (middle == follow_color) {
+      correct(0, middle_forward, middle_noise);
+    }
+
+    float strafe = constrain(offset_gain * offset, -max_strafe_speed, max_strafe_speed);
+    float turn = constrain(angle_gain * angle, -max_turn_rate, max_turn_rate);
+    bot.setVelocity(strafe - forward_speed * angle, forward_speed, turn);
+  }
+
+  /**
+   * @brief Prints the estimate to the serial monitor.
+   */
+  void printout() {
+    Serial.print("Offset: ");
+    Serial.print(offset);
+    Serial.print(" +/- ");
+    Serial.print(sqrt(p00));
+    Serial.print(" cm | Angle: ");
+    Serial.print(angle);
+    Serial.print(" +/- ");
+    Serial.print(sqrt(p11));
+    Serial.println(" rad");
+  }
+
+private:
+  float p00 = 0, p01 = 0, p11 = 0; ///< Covariance of offset and angle.
+  unsigned long lastTime = 0;      ///< Time of the last step in ms.
+
+  /**
+   * @brief Checks whether any IR sensor saw the line on the last read.
+   */
+  bool lineSeen() {
+    for (int i = 0; i < irArray.numSensors; i++) {
+      if (irArray.isSensorTriggered(i)) return true;
+    }
+    return false;
+  }
+
+  /**
+   * @brief Carries the estimate forward by the measured body twist.
+   *
+   * Strafing right moves the line left, driving forward along an angled line moves it
+   * sideways, and turning counterclockwise turns the line clockwise.
+   */
+  void predict(float dt) {
+    BodyTwist twist = bot.pose.velocity;
+    float a = -twist.vy * dt;
+    offset += -twist.vx * dt + a * angle;
+    angle -= twist.omega * dt;
+
+    p00 += a * (2 * p01 + a * p11) + offset_noise * offset_noise * dt;
+    p01 += a * p11;
+    p11 += angle_noise * angle_noise * dt;
+  }
+
+  /**
+   * @brief Corrects the estimate with a reading of the line's offset at a point on the axis.
+   *
+   * @param measured The offset read in cm, positive to the right.
+   * @param forward Position of the reading ahead of the centre in cm.
+   * @param noise Standard deviation of the reading in cm.
+   */
+  void correct(float measured, float forward, float noise) {
+    // The reading is offset - forward * angle
+    float h00 = p00 - forward * p01;
+    float h01 = p01 - forward * p11;
+    float s = h00 - forward * h01 + noise * noise;
+    float k0 = h00 / s;
+    float k1 = h01 / s;
+
+    float innovation = measured - (offset - forward * angle);
+    offset += k0 * innovation;
+    angle += k1 * innovation;
+
+    p00 -= k0 * h00;
+    p01 -= k0 * h01;
+    p11 -= k1 * h01;
+  }
+};
+
 /**
  * @brief Centers the robot on line by rotating based on the used direction and line color.
  * 
@@ -12,6 +12,9 @@
  */
 
 #include "Initialization.h"
+#include "controls/PoseEstimator.h"
+#include <deque>
+#include <functional>
 
 typedef float cm; ///< Define a custom type for measurements in centimeters.
 
@@ -26,6 +29,77 @@ enum Cardinal {
   RIGHT  ///< Represents rightward movement.
 };
 
+/**
+ * @struct WheelCommand
+ * @brief Direction and PWM percentage for a single motor.
+ */
+struct WheelCommand {
+  MoveType move_type;  ///< Direction to drive the motor.
+  percent pwm_percent; ///< PWM percentage to apply to the motor.
+};
+
+/**
+ * @struct DriveCommand
+ * @brief A command for all four motors, applied together by Movement::apply().
+ */
+struct DriveCommand {
+  WheelCommand top;    ///< Command for the top motor.
+  WheelCommand bottom; ///< Command for the bottom motor.
+  WheelCommand left;   ///< Command for the left motor.
+  WheelCommand right;  ///< Command for the right motor.
+};
+
+/**
+ * @enum MotionTaskType
+ * @brief The kind of motion a MotionTask tracks.
+ */
+enum MotionTaskType {
+  TASK_NONE,      ///< No motion in progress.
+  TASK_TRANSLATE, ///< Driving a distance along a fixed direction.
+  TASK_ROTATE,    ///< Turning through an angle.
+};
+
+/**
+ * @struct MotionTask
+ * @brief A distance or angle move in progress, measured against the pose it started at.
+ */
+struct MotionTask {
+  MotionTaskType type = TASK_NONE; ///< What the task is doing.
+  float direction_x = 0;           ///< Unit direction of travel in the start frame, right.
+  float direction_y = 0;           ///< Unit direction of travel in the start frame, forward.
+  float target = 0;                ///< Distance in cm or angle in rad to cover, signed for angles.
+  float speed = 0;                 ///< Cruise speed in cm/sec or rad/sec.
+  float start_x = 0;               ///< Pose x when the task started.
+  float start_y = 0;               ///< Pose y when the task started.
+  float start_heading = 0;         ///< Pose heading when the task started.
+  unsigned long start_time = 0;    ///< Time the task started in ms.
+  unsigned long timeout = 0;       ///< Time after which the task gives up in ms.
+};
+
+/**
+ * @enum MotionSegmentType
+ * @brief The kind of segment in the motion queue.
+ */
+enum MotionSegmentType {
+  SEGMENT_TRANSLATE, ///< Drive a distance, as translateBy().
+  SEGMENT_ROTATE,    ///< Turn through an angle, as rotateBy().
+  SEGMENT_VELOCITY,  ///< Hold a body twist until an event.
+};
+
+/**
+ * @struct MotionSegment
+ * @brief One step of the motion queue.
+ */
+struct MotionSegment {
+  MotionSegmentType type = SEGMENT_TRANSLATE; ///< What the segment does.
+  Cardinal direction = UP;                    ///< Direction of a translate segment.
+  float amount = 0;                           ///< Distance in cm or angle in rad.
+  float speed = 0;                            ///< Cruise speed in cm/sec or rad/sec.
+  BodyTwist velocity = {0, 0, 0};             ///< Twist held by a velocity segment.
+  std::function<bool()> until;                ///< Ends a velocity segment when it returns true.
+  bool stop = false;                          ///< Come to rest at the end of the segment.
+};
+
 /**
  * @class Movement
  * @brief Manages directional control and motion of the robot.
@@ -41,16 +115,71 @@ public:
   float HORIZONTAL_LENGTH = 9;        ///< Length of the robot's horizontal axis in cm.
   float horizontal_distance = 0;      ///< Accumulated horizontal distance traveled.
   float vertical_distance = 0;        ///< Accumulated vertical distance traveled.
+  PoseEstimator pose;                 ///< Dead reckoned pose from wheel odometry.
+  float deceleration = 40;            ///< Ramp-down rate near a translateBy() target in cm/sec^2.
+  float angular_deceleration = 4;     ///< Ramp-down rate near a rotateBy() target in rad/sec^2.
+  cm_per_sec min_task_speed = 6;      ///< Slowest speed of the ramp-down, above the dead zone.
+  float min_task_rate = 0.4;          ///< Slowest turn rate of the ramp-down in rad/sec.
+  cm distance_tolerance = 0.3;        ///< translateBy() finishes this close to the target.
+  float angle_tolerance = 0.02;       ///< rotateBy() finishes this close to the target in rad.
+  float heading_gain = 2;             ///< Turn rate per rad of heading drift during translateBy().
+  MotionTask task;                    ///< The move started by translateBy() or rotateBy().
+  bool motion_done = true;            ///< True once the last task reached its target.
+  float acceleration = 120;           ///< Largest change in queued translation in cm/sec^2.
+  float angular_acceleration = 8;     ///< Largest change in queued turn rate in rad/sec^2.
+  std::deque<MotionSegment> motionQueue; ///< Segments waiting to run, front first.
+
+  /**
+   * @brief Sets up the odometry geometry and zeroes the pose. Call after initMotors().
+   */
+  void initialize() {
+    pose.kinematics.track_width = HORIZONTAL_BOT_LENGTH;
+    pose.kinematics.wheel_base = TOP_MOTOR_TO_IR_ARRAY_LENGTH + BOTTOM_MOTOR_TO_IR_ARRAY_LENGTH;
+    unsigned long now = millis();
+    pose.initialize(getWheelDistances(now), now);
+  }
+
+  /**
+   * @brief Brings every motor's odometer up to a timestamp and returns the readings.
+   * @param now The time in ms to integrate up to.
+   * @return The signed distance of each wheel in cm.
+   */
+  WheelVelocities getWheelDistances(unsigned long now) {
+    topMotor.updateDistance(now);
+    bottomMotor.updateDistance(now);
+    leftMotor.updateDistance(now);
+    rightMotor.updateDistance(now);
+    return {
+      topMotor.getTotalDistance(),
+      bottomMotor.getTotalDistance(),
+      leftMotor.getTotalDistance(),
+      rightMotor.getTotalDistance(),
+    };
+  }
+
+  /**
+   * @brief Integrates the pose if its update period has elapsed.
+   *
+   * Called from apply(), and should be called from any loop that waits on motion.
+   * It also steps the motor slew limiters when they are on.
+   * @return True if the pose was updated.
+   */
+  bool updatePose() {
+    unsigned long now = millis();
+    updateSlew(now);
+    if (!pose.due(now)) return false;
+    pose.update(getWheelDistances(now), now);
+    return true;
+  }
 
   /**
    * @brief Calculate the total horizontal distance traveled by the robot.
    * @return The calculated horizontal distance.
    */
   float getHorizontalDistance() {
-    topMotor.updateDistance();
-    bottomMotor.updateDistance();
-    horizontal_distance = (
-      topMotor.getTotalDistance() + bottomMotor.getTotalDistance()) / 2;
+    unsigned long now = millis();
+    pose.update(getWheelDistances(now), now);
+    horizontal_distance = pose.x;
     return horizontal_distance;
   }
 
@@ -59,20 +188,114 @@ public:
    * @return The calculated vertical distance.
    */
   float getVerticallDistance() {
-    leftMotor.updateDistance();
-    rightMotor.updateDistance();
-    vertical_distance = (leftMotor.getTotalDistance() + rightMotor.getTotalDistance()) / 2;
+    unsigned long now = millis();
+    pose.update(getWheelDistances(now), now);
+    vertical_distance = pose.y;
     return vertical_distance;
   }
 
+  /**
+   * @brief Turns the per-motor acceleration and jerk limits on or off.
+   *
+   * The limiter only advances when the motors are commanded or updatePose() runs, so
+   * turn it on around loops that poll, not around moves that wait in delay(). Turning it
+   * off applies the last command straight away, so do that before an abrupt stop.
+   * @param enabled True to limit every motor.
+   */
+  void setSlewLimited(bool enabled) {
+    topMotor.setSlewLimited(enabled);
+    bottomMotor.setSlewLimited(enabled);
+    leftMotor.setSlewLimited(enabled);
+    rightMotor.setSlewLimited(enabled);
+  }
+
+  /**
+   * @brief Steps every motor's slew limiter.
+   * @param now The current time in ms.
+   */
+  void updateSlew(unsigned long now) {
+    topMotor.updateSlew(now);
+    bottomMotor.updateSlew(now);
+    leftMotor.updateSlew(now);
+    rightMotor.updateSlew(now);
+  }
+
+  /**
+   * @brief Samples the battery and updates every motor's supply compensation.
+   * @param now The current time in ms.
+   */
+  void updateSupply(unsigned long now) {
+    if (!battery.update(now)) return;
+    topMotor.compensateSupply(battery);
+    bottomMotor.compensateSupply(battery);
+    leftMotor.compensateSupply(battery);
+    rightMotor.compensateSupply(battery);
+  }
+
+  /**
+   * @brief Applies a command to all four motors with one shared timestamp.
+   *
+   * Every motor integrates its distance up to the same instant, and each motor only
+   * writes the pins whose values changed since its last command.
+   * @param command The directions and PWM percentages for each motor.
+   */
+  void apply(const DriveCommand& command) {
+    unsigned long now = millis();
+    updateSupply(now);
+    topMotor.driveAt(command.top.move_type, command.top.pwm_percent, now);
+    bottomMotor.driveAt(command.bottom.move_type, command.bottom.pwm_percent, now);
+    leftMotor.driveAt(command.left.move_type, command.left.pwm_percent, now);
+    rightMotor.driveAt(command.right.move_type, command.right.pwm_percent, now);
+    updatePose();
+  }
+
+  /**
+   * @brief Drives every wheel at a signed velocity with one shared timestamp.
+   *
+   * Wheels with encoders hold their velocity in closed loop, the rest run open loop on
+   * their calibration. Call it every loop iteration while the velocities apply.
+   * @param velocities The target of each wheel in cm/sec, positive FORWARD.
+   */
+  void applyVelocity(const WheelVelocities& velocities) {
+    unsigned long now = millis();
+    updateSupply(now);
+    topMotor.driveVelocity(velocities.top, now);
+    bottomMotor.driveVelocity(velocities.bottom, now);
+    leftMotor.driveVelocity(velocities.left, now);
+    rightMotor.driveVelocity(velocities.right, now);
+    updatePose();
+  }
+
+  /**
+   * @brief Drives the robot with a body twist, combining translation and rotation.
+   *
+   * The twist is mixed into the four wheels through the robot geometry. If any wheel
+   * would need more than its calibrated top speed, every wheel is scaled down by the
+   * same factor, so the direction of travel and the turn rate stay in proportion. Call
+   * it every loop iteration while the twist applies.
+   * @param vx Sideways velocity in cm/sec, positive to the right.
+   * @param vy Forward velocity in cm/sec.
+   * @param omega Rotation in rad/sec, positive counterclockwise.
+   * @return The fraction of the requested twist that was applied (1 when unsaturated).
+   */
+  float setVelocity(cm_per_sec vx, cm_per_sec vy, float omega) {
+    WheelVelocities wheels = pose.kinematics.inverse({vx, vy, omega});
+
+    float scale = 1;
+    scale = min(scale, saturation(wheels.top, topMotor.getMaxSpeed()));
+    scale = min(scale, saturation(wheels.bottom, bottomMotor.getMaxSpeed()));
+    scale = min(scale, saturation(wheels.left, leftMotor.getMaxSpeed()));
+    scale = min(scale, saturation(wheels.right, rightMotor.getMaxSpeed()));
+
+    applyVelocity({wheels.top * scale, wheels.bottom * scale, wheels.left * scale, wheels.right * scale});
+    return scale;
+  }
+
   /**
    * @brief Stops all motor activity, effectively halting the robot.
    */
   void stopMotion() {
-    topMotor.drive(OFF, 0);
-    bottomMotor.drive(OFF, 0);
-    leftMotor.drive(OFF, 0);
-    rightMotor.drive(OFF, 0);
+    apply({{OFF, 0}, {OFF, 0}, {OFF, 0}, {OFF, 0}});
   }
 
   /**
@@ -83,28 +306,16 @@ public:
   void move(Cardinal direction,percent percent_pwm){
     switch (direction) {
       case UP:
-        topMotor.drive(OFF,0);
-        bottomMotor.drive(OFF,0);
-        leftMotor.drive(FORWARD, percent_pwm);
-        rightMotor.drive(FORWARD, percent_pwm);
+        apply({{OFF, 0}, {OFF, 0}, {FORWARD, percent_pwm}, {FORWARD, percent_pwm}});
         break;
       case DOWN:
-        topMotor.drive(OFF,0);
-        bottomMotor.drive(OFF,0);
-        leftMotor.drive(BACKWARD, percent_pwm);
-        rightMotor.drive(BACKWARD, percent_pwm);
+        apply({{OFF, 0}, {OFF, 0}, {BACKWARD, percent_pwm}, {BACKWARD, percent_pwm}});
         break;
       case  LEFT:
-        topMotor.drive(FORWARD, percent_pwm);
-        bottomMotor.drive(BACKWARD, percent_pwm);
-        leftMotor.drive(OFF, 0);
-        rightMotor.drive(OFF, 0);
+        apply({{FORWARD, percent_pwm}, {BACKWARD, percent_pwm}, {OFF, 0}, {OFF, 0}});
         break;
       case RIGHT: 
-        topMotor.drive(BACKWARD, percent_pwm);
-        bottomMotor.drive(FORWARD, percent_pwm);
-        leftMotor.drive(OFF, 0);
-        rightMotor.drive(OFF, 0);
+        apply({{BACKWARD, percent_pwm}, {FORWARD, percent_pwm}, {OFF, 0}, {OFF, 0}});
         break;
     }
   }
@@ -116,37 +327,228 @@ public:
    */
   void movePercent(Cardinal direction,percent percent_speed){
     // Move relative to a percent speed
+    percent top_pwm = topMotor.getPercentPwm(percent_speed);
+    percent bottom_pwm = bottomMotor.getPercentPwm(percent_speed);
+    percent left_pwm = leftMotor.getPercentPwm(percent_speed);
+    percent right_pwm = rightMotor.getPercentPwm(percent_speed);
     switch (direction) {
       case UP:
-        topMotor.drive(OFF,0);
-        bottomMotor.drive(OFF,0);
-        leftMotor.driveSpeed(FORWARD, percent_speed);
-        rightMotor.driveSpeed(FORWARD, percent_speed);
+        apply({{OFF, 0}, {OFF, 0}, {FORWARD, left_pwm}, {FORWARD, right_pwm}});
         break;
       case DOWN:
-        topMotor.drive(OFF,0);
-        bottomMotor.drive(OFF,0);
-        leftMotor.driveSpeed(BACKWARD, percent_speed);
-        rightMotor.driveSpeed(BACKWARD, percent_speed);
+        apply({{OFF, 0}, {OFF, 0}, {BACKWARD, left_pwm}, {BACKWARD, right_pwm}});
         break;
       case  LEFT:
-        topMotor.driveSpeed(BACKWARD, percent_speed);
-        bottomMotor.driveSpeed(BACKWARD, percent_speed);
-        leftMotor.drive(OFF, 0);
-        rightMotor.drive(OFF, 0);
+        apply({{BACKWARD, top_pwm}, {BACKWARD, bottom_pwm}, {OFF, 0}, {OFF, 0}});
         break;
       case RIGHT: 
-        topMotor.driveSpeed(FORWARD, percent_speed);
-        bottomMotor.driveSpeed(FORWARD, percent_speed);
-        leftMotor.drive(OFF, 0);
-        rightMotor.drive(OFF, 0);
+        apply({{FORWARD, top_pwm}, {FORWARD, bottom_pwm}, {OFF, 0}, {OFF, 0}});
         break;
     }
   }
 
+  /**
+   * @brief Starts driving a distance in a cardinal direction without blocking.
+   *
+   * Progress is measured from the pose, so sensors can be polled between calls to
+   * updateMotion(). The speed ramps down near the target and the heading is held at its
+   * starting value.
+   * @param direction The cardinal direction to move, relative to the robot at the start.
+   * @param distance The distance to move in cm.
+   * @param speed The cruise speed in cm/sec.
+   */
+  void translateBy(Cardinal direction, cm distance, cm_per_sec speed) {
+    float body_x = (direction == RIGHT) ? 1 : (direction == LEFT) ? -1 : 0;
+    float body_y = (direction == UP) ? 1 : (direction == DOWN) ? -1 : 0;
+    float c = cos(pose.heading);
+    float s = sin(pose.heading);
+
+    startTask(TASK_TRANSLATE, distance, speed);
+    task.direction_x = body_x * c - body_y * s;
+    task.direction_y = body_x * s + body_y * c;
+  }
+
+  /**
+   * @brief Starts driving in a straight line to a point without blocking.
+   *
+   * Works like translateBy(), but the path can be diagonal, so the robot doesn't have to
+   * split it into a sideways and a forward move.
+   * @param x The target position to the right of the pose origin in cm.
+   * @param y The target position forward of the pose origin in cm.
+   * @param speed The cruise speed in cm/sec.
+   */
+  void translateTo(cm x, cm y, cm_per_sec speed) {
+    float dx = x - pose.x;
+    float dy = y - pose.y;
+    cm distance = sqrtf(dx * dx + dy * dy);
+
+    startTask(TASK_TRANSLATE, distance, speed);
+    if (distance > 0) {
+      task.direction_x = dx / distance;
+      task.direction_y = dy / distance;
+    }
+  }
+
+  /**
+   * @brief Starts turning through an angle without blocking.
+   * @param angle The angle to turn in radians, positive counterclockwise (LEFT).
+   * @param rate The cruise turn rate in rad/sec.
+   */
+  void rotateBy(float angle, float rate) {
+    startTask(TASK_ROTATE, angle, rate);
+  }
+
+  /**
+   * @brief Advances the task started by translateBy() or rotateBy().
+   *
+   * Call it every loop iteration until it returns true. The robot stops when the target
+   * is reached, or if the task runs well past its expected duration.
+   * @return True once the task is done.
+   */
+  bool updateMotion() {
+    BodyTwist twist;
+    if (taskTwist(true, twist)) {
+      stopMotion();
+      return true;
+    }
+    setVelocity(twist.vx, twist.vy, twist.omega);
+    return false;
+  }
+
+  /**
+   * @brief Adds a translateBy() segment to the motion queue.
+   * @param direction The cardinal direction to move, relative to the robot at the start.
+   * @param distance The distance to move in cm.
+   * @param speed The cruise speed in cm/sec.
+   * @param stop True to come to rest at the end instead of carrying speed into the next segment.
+   */
+  void queueTranslate(Cardinal direction, cm distance, cm_per_sec speed, bool stop = false) {
+    MotionSegment segment;
+    segment.type = SEGMENT_TRANSLATE;
+    segment.direction = direction;
+    segment.amount = distance;
+    segment.speed = speed;
+    segment.stop = stop;
+    motionQueue.push_back(segment);
+  }
+
+  /**
+   * @brief Adds a rotateBy() segment to the motion queue.
+   * @param angle The angle to turn in radians, positive counterclockwise (LEFT).
+   * @param rate The cruise turn rate in rad/sec.
+   * @param stop True to come to rest at the end instead of carrying speed into the next segment.
+   */
+  void queueRotate(float angle, float rate, bool stop = false) {
+    MotionSegment segment;
+    segment.type = SEGMENT_ROTATE;
+    segment.amount = angle;
+    segment.speed = rate;
+    segment.stop = stop;
+    motionQueue.push_back(segment);
+  }
+
+  /**
+   * @brief Adds a segment that holds a body twist until an event to the motion queue.
+   * @param velocity The body twist to hold.
+   * @param until Returns true when the segment should end. Polled every update.
+   * @param stop True to stop as soon as the event fires.
+   */
+  void queueVelocity(const BodyTwist& velocity, std::function<bool()> until, bool stop = false) {
+    MotionSegment segment;
+    segment.type = SEGMENT_VELOCITY;
+    segment.velocity = velocity;
+    segment.until = until;
+    segment.stop = stop;
+    motionQueue.push_back(segment);
+  }
+
+  /**
+   * @brief Drops every queued segment and stops the robot.
+   */
+  void clearQueue() {
+    motionQueue.clear();
+    segmentActive = false;
+    task.type = TASK_NONE;
+    motion_done = true;
+    stopMotion();
+    commandedTwist = {0, 0, 0};
+  }
+
+  /**
+   * @brief Advances the motion queue.
+   *
+   * The commanded twist moves towards each segment's target within the acceleration
+   * limits, so the robot carries its speed from one segment into the next. Translate and
+   * rotate segments only ramp down to a stop when they are marked stop or are last in
+   * the queue. Call it every loop iteration until it returns true.
+   * @return True once the queue is empty.
+   */
+  bool updateQueue() {
+    unsigned long now = millis();
+    float dt = min((now - lastQueueTime) / 1000.0f, 0.05f);
+    lastQueueTime = now;
+    if (motionQueue.empty()) return true;
+
+    MotionSegment& segment = motionQueue.front();
+    if (!segmentActive) {
+      if (segment.type == SEGMENT_TRANSLATE) {
+        translateBy(segment.direction, segment.amount, segment.speed);
+      } else if (segment.type == SEGMENT_ROTATE) {
+        rotateBy(segment.amount, segment.speed);
+      }
+      segmentActive = true;
+    }
+
+    bool last = segment.stop || motionQueue.size() == 1;
+    BodyTwist target = segment.velocity;
+    bool done;
+    if (segment.type == SEGMENT_VELOCITY) {
+      updatePose();
+      done = !segment.until || segment.until();
+    } else {
+      done = taskTwist(last, target);
+    }
+
+    if (done) {
+      motionQueue.pop_front();
+      segmentActive = false;
+      if (last) {
+        stopMotion();
+        commandedTwist = {0, 0, 0};
+      }
+      return motionQueue.empty();
+    }
+
+    // Limit the change in translation as a vector, so the direction blends smoothly
+    float dvx = target.vx - commandedTwist.vx;
+    float dvy = target.vy - commandedTwist.vy;
+    float change = sqrtf(dvx * dvx + dvy * dvy);
+    float max_change = acceleration * dt;
+    if (change > max_change) {
+      dvx *= max_change / change;
+      dvy *= max_change / change;
+    }
+    float max_turn_change = angular_acceleration * dt;
+    commandedTwist.vx += dvx;
+    commandedTwist.vy += dvy;
+    commandedTwist.omega += constrain(target.omega - commandedTwist.omega, -max_turn_change, max_turn_change);
+    setVelocity(commandedTwist.vx, commandedTwist.vy, commandedTwist.omega);
+    return false;
+  }
+
+  /**
+   * @brief Runs the motion queue until it is empty.
+   */
+  void runQueue() {
+    lastQueueTime = millis();
+    while (!updateQueue()) {}
+  }
+
   /**
    * @brief Translates the robot in a specified direction for a given distance at a
    * specified speed.
+   *
+   * Blocks until translateBy() reaches the distance.
    * @param direction The cardinal direction to move.
    * @param percent_pwm The PWM percentage to apply to the motors.
    * @param distance The distance to move in centimeters.
@@ -154,37 +556,14 @@ public:
   void translate(Cardinal direction, percent percent_pwm, cm distance) {
     // Get the calibrated speed in cm/s based on the provided PWM percent
     float speed;
-    float left_speed;
-    float right_speed;
-    float top_speed;
-    float bottom_speed;
-
-    switch (direction) {
-      case UP:
-      case DOWN:
-        left_speed = leftMotor.getSpeed(percent_pwm);
-        right_speed = rightMotor.getSpeed(percent_pwm);
-        speed = max(left_speed,right_speed)/1.1;
-        break;
-      case RIGHT:
-      case LEFT:
-        top_speed = topMotor.getSpeed(percent_pwm);
-        bottom_speed = bottomMotor.getSpeed(percent_pwm);
-        speed = max(top_speed,bottom_speed)/1.2;
-        break;
-      default:
-        Serial.println("TERMINAL ERROR");
-        Serial.print("An incorrect direction was set for the");
-        Serial.print("Motion.translate function.");
-        speed = 0;
-        break;
+    if (direction == UP || direction == DOWN) {
+      speed = (leftMotor.getSpeed(percent_pwm) + rightMotor.getSpeed(percent_pwm)) / 2;
+    } else {
+      speed = (topMotor.getSpeed(percent_pwm) + bottomMotor.getSpeed(percent_pwm)) / 2;
     }
 
-    // Calculate the duration in milliseconds to cover the given distance
-    ms duration = (ms)((distance / speed) * 1000);
-    move(direction,percent_pwm);
-    delay(duration);
-    stopMotion();
+    translateBy(direction, distance, speed);
+    while (!updateMotion()) {}
   }
 
   /**
@@ -202,19 +581,117 @@ public:
         Serial.println("Shouldn't be turning Down.");
         break;
       case  RIGHT:
-        topMotor.drive(BACKWARD, percent_pwm*VERTICAL_VS_HORIZONTAL);
-        bottomMotor.drive(BACKWARD, percent_pwm*VERTICAL_VS_HORIZONTAL);
-        leftMotor.drive(FORWARD, percent_pwm);
-        rightMotor.drive(BACKWARD, percent_pwm);
+        apply({
+          {BACKWARD, percent_pwm*VERTICAL_VS_HORIZONTAL},
+          {BACKWARD, percent_pwm*VERTICAL_VS_HORIZONTAL},
+          {FORWARD, percent_pwm},
+          {BACKWARD, percent_pwm}});
         break;
       case LEFT: 
-        topMotor.drive(FORWARD, percent_pwm*VERTICAL_VS_HORIZONTAL);
-        bottomMotor.drive(FORWARD, percent_pwm*VERTICAL_VS_HORIZONTAL);
-        leftMotor.drive(BACKWARD, percent_pwm);
-        rightMotor.drive(FORWARD, percent_pwm);
+        apply({
+          {FORWARD, percent_pwm*VERTICAL_VS_HORIZONTAL},
+          {FORWARD, percent_pwm*VERTICAL_VS_HORIZONTAL},
+          {BACKWARD, percent_pwm},
+          {FORWARD, percent_pwm}});
         break;
     }
   }
+
+private:
+  bool segmentActive = false;         ///< True once the front segment has started.
+  BodyTwist commandedTwist = {0, 0, 0}; ///< Twist the queue is currently driving.
+  unsigned long lastQueueTime = 0;    ///< Time of the last queue update.
+
+  /**
+   * @brief Measures the current task and works out the twist that continues it.
+   * @param ramp_down True to slow down towards the target, false to cruise through it.
+   * @param twist Set to the body twist for the task when it isn't done.
+   * @return True once the task is done.
+   */
+  bool taskTwist(bool ramp_down, BodyTwist& twist) {
+    if (motion_done) return true;
+
+    unsigned long now = millis();
+    updatePose();
+    float remaining = 0;
+    if (task.type == TASK_TRANSLATE) {
+      float progress = (pose.x - task.start_x) * task.direction_x +
+                       (pose.y - task.start_y) * task.direction_y;
+      remaining = task.target - progress;
+    } else if (task.type == TASK_ROTATE) {
+      float turned = pose.heading - task.start_heading;
+      remaining = fabs(task.target) - ((task.target >= 0) ? turned : -turned);
+    }
+
+    float tolerance = (task.type == TASK_ROTATE) ? angle_tolerance : distance_tolerance;
+    if (remaining <= tolerance || now - task.start_time >= task.timeout) {
+      if (remaining > tolerance) {
+        Serial.println("Motion task timed out.");
+      }
+      task.type = TASK_NONE;
+      motion_done = true;
+      return true;
+    }
+
+    if (task.type == TASK_TRANSLATE) {
+      float speed = task.speed;
+      if (ramp_down) {
+        speed = min(speed, max(min_task_speed, sqrtf(2 * deceleration * remaining)));
+      }
+      // Rotate the fixed direction of travel into the current body frame
+      float c = cos(pose.heading);
+      float s = sin(pose.heading);
+      twist.vx = speed * (task.direction_x * c + task.direction_y * s);
+      twist.vy = speed * (-task.direction_x * s + task.direction_y * c);
+      twist.omega = heading_gain * (task.start_heading - pose.heading);
+    } else {
+      float rate = task.speed;
+      if (ramp_down) {
+        rate = min(rate, max(min_task_rate, sqrtf(2 * angular_deceleration * remaining)));
+      }
+      twist = {0, 0, (task.target >= 0) ? rate : -rate};
+    }
+    return false;
+  }
+
+  /**
+   * @brief Records the starting pose of a new task.
+   * @param type The kind of task.
+   * @param target The distance or signed angle to cover.
+   * @param speed The cruise speed or turn rate.
+   */
+  void startTask(MotionTaskType type, float target, float speed) {
+    unsigned long now = millis();
+    pose.update(getWheelDistances(now), now);
+
+    task.type = type;
+    task.target = target;
+    task.speed = speed;
+    task.direction_x = 0;
+    task.direction_y = 0;
+    task.start_x = pose.x;
+    task.start_y = pose.y;
+    task.start_heading = pose.heading;
+    task.start_time = now;
+    motion_done = (speed <= 0 || target == 0);
+    if (speed <= 0) {
+      Serial.println("Motion task has no speed, skipping it.");
+    }
+
+    // Give up if the task takes three times as long as cruising the whole way would
+    task.timeout = (speed > 0) ? (unsigned long)(3000 * fabs(target) / speed) + 1000 : 0;
+  }
+
+  /**
+   * @brief Gets the scale that brings a wheel velocity within its top speed.
+   * @param velocity The signed wheel velocity in cm/sec.
+   * @param max_speed The wheel's top speed in cm/sec.
+   * @return The scale, 1 if the wheel is within its limit.
+   */
+  float saturation(cm_per_sec velocity, cm_per_sec max_speed) {
+    if (fabs(velocity) <= max_speed || max_speed <= 0) return 1;
+    return max_speed / fabs(velocity);
+  }
 };
 
 // Initializes the Movement class instance to be available globally.
@@ -0,0 +1,395 @@
+/**
+ * @file MotorSelfCalibration.h
+ * @brief Defines the MotorSelfCalibration class for re-measuring the motor tables on the robot.
+ *
+ * This file contains the definition of the MotorSelfCalibration class, which replaces the
+ * bench-measured motor calibration tables with ones measured on the robot itself. Facing
+ * a flat wall, it sweeps the PWM on each wheel pair and measures the true speed from the
+ * ultrasonic sensors:
+ * - Left and right motors: the robot drives towards and away from the wall, and the speed
+ *   is the rate of change of the middle sonar's range.
+ * - Top and bottom motors: they can only push sideways, so the robot spins in place on
+ *   them, and the wheel speed comes from the rate the wall angle changes between the left
+ *   and right sonars.
+ * The robot is brought back to its starting range or angle before every PWM step, so each
+ * pass has the full range to sweep. A table is only kept if every row was measured and
+ * its speeds rise with the PWM. The new tables are saved to EEPROM and loaded at boot in
+ * place of the ones hardcoded in initMotors().
+ */
+
+#ifndef MOTOR_SELF_CALIBRATION_H
+#define MOTOR_SELF_CALIBRATION_H
+
+#include <Arduino.h>
+#include <EEPROM.h>
+#include "Initialization.h"
+#include "Motion.h"
+
+#define MOTOR_CALIBRATION_EEPROM_ADDRESS 0          ///< Start of the stored tables in EEPROM.
+#define MOTOR_CALIBRATION_EEPROM_MAGIC 0x4D43414CUL ///< "MCAL", marks a valid record.
+#define MOTOR_CALIBRATION_EEPROM_VERSION 1          ///< Bumped when the record layout changes.
+#define MOTOR_CALIBRATION_STORED_POINTS 16          ///< Points stored per motor.
+
+/**
+ * @struct StoredMotorCalibration
+ * @brief Layout of the calibration record kept in EEPROM.
+ */
+struct StoredMotorCalibration {
+  uint32_t magic;
+  uint16_t version;
+  uint8_t counts[4];                                   ///< Points per motor: top, bottom, left, right
+  float points[4][MOTOR_CALIBRATION_STORED_POINTS][4]; ///< {speed_percent, pwm_percent, speed, voltage}
+  uint32_t checksum;
+};
+
+/**
+ * @class MotorSelfCalibration
+ * @brief Measures the motor calibration tables on the robot and keeps them in EEPROM.
+ */
+class MotorSelfCalibration {
+  public:
+    float sweep_pwm[10] = {15, 20, 25, 30, 40, 50, 60, 70, 80, 100}; ///< PWM values to measure.
+    int sweep_points = 10;               ///< Number of sweep_pwm values used.
+    unsigned long settle_time = 200;     ///< Time to let the robot reach speed before sampling (ms).
+    unsigned long sample_time = 600;     ///< Sampling time per direction per PWM value (ms).
+    cm stop_distance = 12;               ///< Stop a pass early when the wall is this close.
+    cm_per_sec moving_threshold = 0.5;   ///< Slower than this counts as the dead zone.
+    float max_spin_angle = 0.35;         ///< Stop a spin pass early past this wall angle (rad).
+    float spin_start_angle = -0.28;      ///< Wall angle each spin step starts from, so the first pass sweeps most of the range (rad).
+    int max_samples = 64;                ///< Most samples kept per pass.
+    float recentre_gain = 2;             ///< Return speed per unit of error when recentring, in 1/sec.
+    float recentre_min_rate = 0.2;       ///< Slowest turn when recentring a spin (rad/sec).
+    cm_per_sec recentre_min_speed = 3;   ///< Slowest drive when recentring a drive (cm/sec).
+    float recentre_angle_tolerance = 0.03; ///< Wall angle error counted as recentred (rad).
+    cm recentre_range_tolerance = 1;     ///< Range error counted as recentred.
+    unsigned long recentre_timeout = 3000; ///< Longest time spent recentring (ms).
+
+    /**
+     * @brief Measures new tables for all four motors, applies them, and saves them.
+     *
+     * The robot should start facing a flat wall, roughly square to it and 60 cm or more away.
+     */
+    void run() {
+      Serial.println("| ==== Motor Self Calibration ==== |");
+      std::vector<MotorCalibration> top, bottom, left, right;
+
+      Serial.println("== Calibrating left and right motors ==");
+      bool drive_measured = calibratePair(false, leftMotor, rightMotor, left, right);
+      Serial.println("== Calibrating top and bottom motors ==");
+      bool spin_measured = calibratePair(true, topMotor, bottomMotor, top, bottom);
+
+      if (!drive_measured && !spin_measured) {
+        Serial.println("No tables measured, nothing saved.");
+        return;
+      }
+      if (spin_measured) {
+        topMotor.setCalibrationData(top);
+        bottomMotor.setCalibrationData(bottom);
+      }
+      if (drive_measured) {
+        leftMotor.setCalibrationData(left);
+        rightMotor.setCalibrationData(right);
+      }
+      save();
+
+      printout(topMotor);
+      printout(bottomMotor);
+      printout(leftMotor);
+      printout(rightMotor);
+    }
+
+    /**
+     * @brief Loads the tables saved by run() into the motors.
+     *
+     * Motors keep their hardcoded tables if nothing valid is stored, or if their stored
+     * table has a stalled or non-increasing row.
+     * @return True if the stored tables were loaded.
+     */
+    bool load() {
+      StoredMotorCalibration record;
+      EEPROM.get(MOTOR_CALIBRATION_EEPROM_ADDRESS, record);
+      if (record.magic != MOTOR_CALIBRATION_EEPROM_MAGIC ||
+          record.version != MOTOR_CALIBRATION_EEPROM_VERSION ||
+          record.checksum != checksum(record)) {
+        return false;
+      }
+
+      Motor* motors[4] = {&topMotor, &bottomMotor, &leftMotor, &rightMotor};
+      for (int m = 0; m < 4; m++) {
+        if (record.counts[m] < 2 || record.counts[m] > MOTOR_CALIBRATION_STORED_POINTS) continue;
+        std::vector<MotorCalibration> data;
+        for (int i = 0; i < record.counts[m]; i++) {
+          const float* point = record.points[m][i];
+          data.push_back({point[0], point[1], point[2], point[3]});
+        }
+        if (!isValidTable(data)) {
+          Serial.print(motors[m]->label);
+          Serial.println(": stored table is invalid, keeping the hardcoded one.");
+          continue;
+        }
+        motors[m]->setCalibrationData(data);
+      }
+      Serial.println("Loaded motor calibrations from EEPROM.");
+      return true;
+    }
+
+    /**
+     * @brief Saves every motor's current table to EEPROM.
+     */
+    void save() {
+      StoredMotorCalibration record;
+      memset(&record, 0, sizeof(record)); // Zero the padding so the checksum is repeatable
+      record.magic = MOTOR_CALIBRATION_EEPROM_MAGIC;
+      record.version = MOTOR_CALIBRATION_EEPROM_VERSION;
+
+      Motor* motors[4] = {&topMotor, &bottomMotor, &leftMotor, &rightMotor};
+      for (int m = 0; m < 4; m++) {
+        int n = min((int)motors[m]->calibrations.size(), MOTOR_CALIBRATION_STORED_POINTS);
+        record.counts[m] = n;
+        for (int i = 0; i < n; i++) {
+          record.points[m][i][0] = motors[m]->calibrations[i].speed_percent;
+          record.points[m][i][1] = motors[m]->calibrations[i].pwm_percent;
+          record.points[m][i][2] = motors[m]->calibrations[i].speed;
+          record.points[m][i][3] = motors[m]->calibrations[i].voltage;
+        }
+      }
+      record.checksum = checksum(record);
+      EEPROM.put(MOTOR_CALIBRATION_EEPROM_ADDRESS, record);
+      Serial.println("Saved motor calibrations to EEPROM.");
+    }
+
+    /**
+     * @brief Prints a motor's table in the same form as initMotors().
+     * @param motor The motor to print.
+     */
+    void printout(Motor& motor) {
+      Serial.print(motor.label);
+      Serial.println(":");
+      for (const auto& cal : motor.calibrations) {
+        Serial.print("  {");
+        Serial.print(cal.speed_percent);
+        Serial.print(", ");
+        Serial.print(cal.pwm_percent);
+        Serial.print(", ");
+        Serial.print(cal.speed, 4);
+        Serial.println("},");
+      }
+    }
+
+    /**
+     * @brief Checks that a table can be inverted and only stalls at its first row.
+     *
+     * Within each voltage, the PWM and the speed must both rise from row to row, and every
+     * row after the first must move the wheel.
+     * @param data The table to check.
+     * @return True if the table is usable.
+     */
+    bool isValidTable(const std::vector<MotorCalibration>& data) {
+      if (data.size() < 2) return false;
+      for (size_t i = 1; i < data.size(); i++) {
+        if (data[i].voltage != data[i - 1].voltage) continue;
+        if (data[i].speed <= 0) return false;
+        if (data[i].pwm_percent <= data[i - 1].pwm_percent) return false;
+        if (data[i].speed <= data[i - 1].speed) return false;
+      }
+      return true;
+    }
+
+  private:
+    /**
+     * @brief FNV-1a over the record, excluding the checksum at its end.
+     */
+    uint32_t checksum(const StoredMotorCalibration& record) {
+      const uint8_t* bytes = (const uint8_t*)&record;
+      uint32_t hash = 2166136261UL;
+      for (size_t i = 0; i < sizeof(record) - sizeof(record.checksum); i++) {
+        hash = (hash ^ bytes[i]) * 16777619UL;
+      }
+      return hash;
+    }
+
+    /**
+     * @brief Least squares slope of value against time.
+     * @return The slope per second, 0 with fewer than three samples.
+     */
+    float fitSlope(const float* times, const float* values, int n) {
+      if (n < 3) return 0;
+      float mean_t = 0, mean_v = 0;
+      for (int i = 0; i < n; i++) {
+        mean_t += times[i];
+        mean_v += values[i];
+      }
+      mean_t /= n;
+      mean_v /= n;
+      float num = 0, den = 0;
+      for (int i = 0; i < n; i++) {
+        num += (times[i] - mean_t) * (values[i] - mean_v);
+        den += (times[i] - mean_t) * (times[i] - mean_t);
+      }
+      return (den > 0) ? num / den : 0;
+    }
+
+    /**
+     * @brief Reads the quantity a pass measures.
+     * @param spin True for the wall angle in radians, false for the middle range in cm.
+     */
+    float measure(bool spin) {
+      if (spin) {
+        return atan2(leftSonic.getDistance() - rightSonic.getDistance(), SONAR_SPACING);
+      }
+      return middleSonic.getDistance();
+    }
+
+    /**
+     * @brief Brings the robot back to a wall angle or range, using the sonars.
+     * @param spin True to turn to a wall angle, false to drive to a middle range.
+     * @param target The wall angle in radians or the range in cm.
+     */
+    void recentre(bool spin, float target) {
+      unsigned long start = millis();
+      while (millis() - start < recentre_timeout) {
+        float error = target - measure(spin);
+        if (fabs(error) <= (spin ? recentre_angle_tolerance : recentre_range_tolerance)) break;
+        if (spin) {
+          // Turning counterclockwise raises the angle, as in WallAligner
+          float rate = constrain(recentre_gain * fabs(error), recentre_min_rate, 1.0f);
+          bot.setVelocity(0, 0, (error > 0) ? rate : -rate);
+        } else {
+          // Too close (range under the target) means backing away
+          float speed = constrain(recentre_gain * fabs(error), recentre_min_speed, 15.0f);
+          bot.setVelocity(0, (error > 0) ? -speed : speed, 0);
+        }
+      }
+      bot.stopMotion();
+      delay(300); // Let the robot come to rest before the next pass
+    }
+
+    /**
+     * @brief Drives one pass at a PWM and measures the rate of change.
+     *
+     * The pass stops early once it moves past the limit in its own direction (too close
+     * to the wall, or too far round), but not for starting beyond the limit on the side
+     * it is moving away from.
+     * @param spin True to spin on the top and bottom motors, false to drive forward/back.
+     * @param towards True for the pass towards the wall (or counterclockwise when spinning).
+     * @param pwm The PWM percentage for both motors.
+     * @param rate Set to the rate of change in units per second.
+     * @return True if enough samples were taken to fit the rate.
+     */
+    bool measurePass(bool spin, bool towards, percent pwm, float& rate) {
+      float times[64];
+      float values[64];
+      int n = 0;
+      int limit = min(max_samples, 64);
+
+      if (spin) {
+        MoveType direction = towards ? FORWARD : BACKWARD;
+        bot.apply({{direction, pwm}, {direction, pwm}, {OFF, 0}, {OFF, 0}});
+      } else {
+        bot.move(towards ? UP : DOWN, pwm);
+      }
+
+      unsigned long start = millis();
+      while (millis() - start < settle_time + sample_time && n < limit) {
+        float value = measure(spin);
+        unsigned long now = millis();
+        if (!spin && towards && value < stop_distance) break;
+        if (spin && (towards ? value : -value) > max_spin_angle) break;
+        if (now - start >= settle_time) {
+          times[n] = (now - start) / 1000.0;
+          values[n] = value;
+          n++;
+        }
+      }
+      bot.stopMotion();
+      delay(300); // Let the robot come to rest before the next pass
+      rate = fitSlope(times, values, n);
+      return n >= 3;
+    }
+
+    /**
+     * @brief Sweeps the PWM on a pair of motors and fits a new table for each.
+     *
+     * Both motors run at the same PWM, so the sonars measure their average speed. The
+     * split between the two follows the ratio in their current tables. The PWM is still
+     * battery compensated against the current tables, so the new rows keep their voltage.
+     * A step where neither pass got enough samples is left out of the tables.
+     * @param spin True for the top/bottom pair, false for the left/right pair.
+     * @return True if both tables were measured and are valid. Otherwise they're cleared.
+     */
+    bool calibratePair(bool spin, Motor& a, Motor& b,
+                       std::vector<MotorCalibration>& table_a, std::vector<MotorCalibration>& table_b) {
+      float half_base = (TOP_MOTOR_TO_IR_ARRAY_LENGTH + BOTTOM_MOTOR_TO_IR_ARRAY_LENGTH) / 2;
+      float speeds[10];
+      bool measured[10];
+      int n = min(sweep_points, 10);
+      float home = spin ? spin_start_angle : measure(false);
+
+      for (int i = 0; i < n; i++) {
+        // Out and back at the same PWM, each step starting from the same place
+        recentre(spin, home);
+        float rate_out = 0, rate_back = 0;
+        bool out_measured = measurePass(spin, true, sweep_pwm[i], rate_out);
+        bool back_measured = measurePass(spin, false, sweep_pwm[i], rate_back);
+        float rate = (out_measured && back_measured) ? (fabs(rate_out) + fabs(rate_back)) / 2
+                   : out_measured ? fabs(rate_out) : fabs(rate_back);
+        measured[i] = out_measured || back_measured;
+        speeds[i] = spin ? rate * half_base : rate;
+
+        Serial.print("PWM ");
+        Serial.print(sweep_pwm[i]);
+        if (measured[i]) {
+          Serial.print("% -> ");
+          Serial.print(speeds[i]);
+          Serial.println(" cm/s");
+        } else {
+          Serial.println("% -> not enough samples, skipped");
+        }
+      }
+      recentre(spin, spin ? 0 : home);
+
+      // The dead zone ends at the last PWM that didn't move the robot
+      int first_moving = 0;
+      while (first_moving < n && !(measured[first_moving] && speeds[first_moving] >= moving_threshold)) {
+        first_moving++;
+      }
+      if (first_moving >= n - 1) {
+        Serial.println("Robot didn't move, keeping the old tables.");
+        return false;
+      }
+      percent dead_zone = (first_moving > 0) ? sweep_pwm[first_moving - 1] : 0;
+
+      table_a.clear();
+      table_b.clear();
+      table_a.push_back({0, dead_zone, 0, a.calibrationVoltage});
+      table_b.push_back({0, dead_zone, 0, b.calibrationVoltage});
+      for (int i = first_moving; i < n; i++) {
+        if (!measured[i]) continue;
+        percent pwm = sweep_pwm[i];
+        float speed_percent = (pwm - dead_zone) / (100 - dead_zone) * 100;
+
+        float old_a = a.getSpeed(pwm);
+        float old_b = b.getSpeed(pwm);
+        float share_a = 1, share_b = 1;
+        if (old_a > 0 && old_b > 0) {
+          share_a = 2 * old_a / (old_a + old_b);
+          share_b = 2 * old_b / (old_a + old_b);
+        }
+        table_a.push_back({speed_percent, pwm, speeds[i] * share_a, a.calibrationVoltage});
+        table_b.push_back({speed_percent, pwm, speeds[i] * share_b, b.calibrationVoltage});
+      }
+
+      if (!isValidTable(table_a) || !isValidTable(table_b)) {
+        Serial.println("Measured speeds stall or don't rise with PWM, keeping the old tables.");
+        table_a.clear();
+        table_b.clear();
+        return false;
+      }
+      return true;
+    }
+};
+
+// Initializes the MotorSelfCalibration class instance to be available globally.
+MotorSelfCalibration motorSelfCalibration;
+
+#endif // MOTOR_SELF_CALIBRATION_H
@@ -12,6 +12,8 @@
 #define OBSTACLEAVOIDANCE_H
 
 #include "Motion.h"
+#include "controls/WallAligner.h"
+#include "controls/OccupancyGrid.h"
 
 class ObstacleAvoidance {
 public:
@@ -23,6 +25,7 @@ public:
     SEARCH_FORWARD, ///< State to search for obstacles moving forward.
     SEARCH_LEFT,    ///< State to search for obstacles moving left.
     SEARCH_RIGHT,   ///< State to search for obstacles moving right.
+    PLAN_GAP,       ///< State to drive straight to a gap seen in the map.
     FOUND_END,      ///< State indicating that the end has been found.
   };
 
@@ -40,10 +43,37 @@ public:
   percent LEFT_SPEED = 100;                 ///< Speed for leftward "crab walk" motion.
   percent RIGHT_SPEED = 100;                ///< Speed for rightward "crab walk" motion.
   percent FORWARD_SPEED = 100;              ///< Speed for forward and backward motion.
-  percent PERPENDICLUAR_TURN_SPEED = 80;    ///< Speed for turning to become perpendicular.
   int obstacles_cleared = 0;                ///< Counter for obstacles cleared.
   int NUMBER_OF_OBSTACLES = 3;              ///< Total number of obstacles to clear.
   cm CLEARANCE_SIZE = 8.5;                  ///< Clearance size for navigation.
+  unsigned long SONAR_MAX_AGE = 30;         ///< Oldest sonar reading reused within a cycle, in ms. Raised to a SonarManager cycle in run().
+  int ALIGN_MAX_CYCLES = 40;                ///< Most sonar cycles spent squaring up to a wall.
+  unsigned long SONAR_WAIT = 100;           ///< Longest wait for a new sonar reading, in ms.
+  WallAligner aligner;                      ///< Proportional yaw controller for squaring up.
+  PIDController wallPid;                    ///< Holds MEAN_DISTANCE from the wall while crab walking.
+  float WALL_KP = 1.5;                      ///< Forward cm/sec per cm of wall distance error.
+  float WALL_KI = 0.1;                      ///< Integral gain of the wall distance PID.
+  float WALL_KD = 0.2;                      ///< Derivative gain of the wall distance PID.
+  cm_per_sec WALL_FOLLOW_MAX_SPEED = 15;    ///< Fastest forward or backward correction while crab walking.
+  float CRAB_SPEED_FRACTION = 0.8;          ///< Share of the crab walk wheels' top speed used, leaving room to turn.
+
+  bool debug = false;                       ///< Print the sonar cache stats after every run() step.
+  bool USE_GAP_PLANNER = true;              ///< Map the course and drive straight to gaps once seen.
+  cm_per_sec GAP_PATH_SPEED = 30;           ///< Cruise speed along the path to a gap.
+  cm SONAR_OFFSET = VERTICAL_BOT_LENGTH/2;  ///< Distance from the robot's centre forward to the sonars.
+  OccupancyGrid grid;                       ///< Map of the course filled in from the sonars.
+  GapPlanner planner;                       ///< Finds the nearest gap in the wall ahead.
+  GapPlan gap;                              ///< Latest plan.
+  cm last_wall_y = 0;                       ///< Pose y of the last wall passed, so it isn't planned again.
+  uint32_t mapped_readings[3] = {0, 0, 0};  ///< Sonar readings already added to the map.
+  unsigned long course_start_time = 0;      ///< Time the course started in ms, 0 before run().
+
+  bool USE_WALL_CORRECTION = true;          ///< Correct the pose with sonar ranges to the wall being followed.
+  cm WALL_CORRECTION_RANGE = 60;            ///< Longest range trusted to come from the wall.
+  cm SONAR_RANGE_NOISE = 1.5;               ///< Standard deviation of a sonar range.
+  WallLine wall;                            ///< The wall the pose is corrected against.
+  bool wall_known = false;                  ///< True while wall is the wall in front of the robot.
+  uint32_t corrected_readings[3] = {0, 0, 0}; ///< Sonar readings already used to correct the pose.
 
   /**
    * @brief Checks if the robot is perpendicular to a wall using ultrasonic sensors.
@@ -57,7 +87,7 @@ public:
     bool is_perpendicular;
 
     ultrasonic_distance_difference = abs(
-      leftSonic.getDistance() - rightSonic.getDistance());
+      leftSonic.getFilteredDistance(SONAR_MAX_AGE) - rightSonic.getFilteredDistance(SONAR_MAX_AGE));
     is_perpendicular = ultrasonic_distance_difference <= PERPENDICULAR_DISTANCE_MARGIN_OF_ERROR;
     return is_perpendicular;
   }
@@ -69,26 +99,26 @@ public:
    */
   bool within_band(Cardinal direction) {
     UltraSonic& sonic = (direction == LEFT) ? leftSonic : rightSonic;
-    sonic.getDistance();
-    bool withinBand = (sonic.distance >= MIN_DISTANCE && sonic.distance <= MAX_DISTANCE);
+    cm distance = sonic.getFilteredDistance(SONAR_MAX_AGE);
+    bool withinBand = (distance >= MIN_DISTANCE && distance <= MAX_DISTANCE);
     return withinBand;
   }
 
   /**
    * @brief Adjusts the robot's orientation to become perpendicular to the nearest wall.
+   *
+   * Each cycle waits for a new left and right range, measures the wall angle from them,
+   * and turns at a rate proportional to it, for at most ALIGN_MAX_CYCLES cycles.
    */
   void become_perpendicular() {
-    bool perpendicular = false;
-    while (!perpendicular) {
-
-      // the perpendicular function already gets the distance.
-      perpendicular = within_perpendicular_band();
-
-      if (leftSonic.distance > rightSonic.distance) {
-        bot.turn(RIGHT,PERPENDICLUAR_TURN_SPEED);
-      } else {
-        bot.turn(LEFT,PERPENDICLUAR_TURN_SPEED);
-      }
+    aligner.initialize(SONAR_SPACING);
+    for (int cycle = 0; cycle < ALIGN_MAX_CYCLES; cycle++) {
+      leftSonic.waitForReading(SONAR_WAIT);
+      rightSonic.waitForReading(SONAR_WAIT);
+      float rate = aligner.update(
+        leftSonic.getFilteredDistance(SONAR_MAX_AGE), rightSonic.getFilteredDistance(SONAR_MAX_AGE));
+      if (aligner.aligned()) break;
+      bot.setVelocity(0, 0, rate);
     }
     bot.stopMotion();
   }
@@ -116,52 +146,63 @@ public:
     Serial.print(direction_string);
     Serial.println(" ====");
 
-    unsigned long lastReorientTime = millis();
+    cm_per_sec crab_speed = CRAB_SPEED_FRACTION * min(
+      topMotor.getSpeed(move_speed), bottomMotor.getSpeed(move_speed));
+    cm_per_sec crab_velocity = (direction == LEFT) ? -crab_speed : crab_speed;
+    aligner.initialize(SONAR_SPACING);
+    wallPid.Kp = WALL_KP;
+    wallPid.Ki = WALL_KI;
+    wallPid.Kd = WALL_KD;
+    wallPid.setOutputLimits(-WALL_FOLLOW_MAX_SPEED, WALL_FOLLOW_MAX_SPEED);
+    wallPid.initialize();
+    uint32_t pid_readings = oppositeSonic.filtered_readings;
+    cm_per_sec forward = 0;
+    cm wall_y = last_wall_y;
+    if (!wall_known) registerWall();
 
     while (true){
-      // Check if 2 seconds have passed since the last reorientation
-      bool reorient_timing = (millis() - lastReorientTime >= REORIENT_TIME);
-      bool no_gap = (GAP_DISTANCE >= likeSonic.getDistance());
-      bool ultrasonic_difference = (
-        likeSonic.getDistance() - oppositeSonic.getDistance()
-        ) <= MAX_PERPENDICULAR_DIFFERENCE;
-
-      if (reorient_timing && no_gap && ultrasonic_difference) {
-        become_perpendicular();
-        lastReorientTime = millis(); // Reset the timer
-      }
+      correctPose();
+      cm like_distance = likeSonic.getFilteredDistance(SONAR_MAX_AGE);
+      cm opposite_distance = oppositeSonic.getFilteredDistance(SONAR_MAX_AGE);
 
-      while (within_band(direction)){
-        bot.move(direction,move_speed);
-        if (likeColor.getColor() == WHITE) {
-          leftColor.clearColorHistory();
-          rightColor.clearColorHistory();
-          return opposite_search;
-        }
+      // The trailing sonar has left the wall, so the robot is clear of the obstacle. The
+      // median catches the edge a reading behind; the filtered range holds the wall longer.
+      if (oppositeSonic.filter.median_range >= MAX_DISTANCE){
+        bot.translate(direction,move_speed,CLEARANCE_SIZE);
+        obstacles_cleared +=1;
+        last_wall_y = wall_y;
+        wall_known = false;
+        return SEARCH_FORWARD;
       }
 
-      // If we're too far forward 
-      if (MIN_DISTANCE >= oppositeSonic.getDistance()) {
-        while (MIN_DISTANCE >= oppositeSonic.getDistance()){
-          bot.move(DOWN,FORWARD_SPEED);
-        }
-        bool no_gap = (GAP_DISTANCE >= likeSonic.getDistance());
-        bool ultrasonic_difference = (
-          likeSonic.getDistance() - oppositeSonic.getDistance()
-          ) <= MAX_PERPENDICULAR_DIFFERENCE;
+      if (USE_GAP_PLANNER) {
+        cm front_x, front_y;
+        frontPosition(front_x, front_y);
+        wall_y = front_y + opposite_distance;
+        // Once the map shows a gap, cut across to it rather than waiting to pass the edge
+        if (updateMap() && planGap()) return PLAN_GAP;
+      }
 
-        if (no_gap && ultrasonic_difference) {
-          become_perpendicular();
-          lastReorientTime = millis(); // Reset the timer
-        }
+      if (likeColor.getColor() == WHITE) {
+        leftColor.clearColorHistory();
+        rightColor.clearColorHistory();
+        return opposite_search;
       }
 
-      // If we're too far back
-      if (oppositeSonic.getDistance() >= MAX_DISTANCE){
-        bot.translate(direction,move_speed,CLEARANCE_SIZE);
-        obstacles_cleared +=1;
-        return SEARCH_FORWARD;
+      // Hold MEAN_DISTANCE on the trailing sonar, which stays on the wall the longest, and
+      // square up while both sonars see the same wall
+      bool no_gap = (GAP_DISTANCE >= likeSonic.filter.median_range);
+      bool ultrasonic_difference = (like_distance - opposite_distance) <= MAX_PERPENDICULAR_DIFFERENCE;
+      float rate = 0;
+      if (no_gap && ultrasonic_difference) {
+        rate = aligner.update(leftSonic.filter.range, rightSonic.filter.range);
       }
+      if (oppositeSonic.filtered_readings != pid_readings) {
+        // Only step the PID on new ranges, so the derivative sees the sonar's real period
+        pid_readings = oppositeSonic.filtered_readings;
+        forward = wallPid.compute(opposite_distance - MEAN_DISTANCE);
+      }
+      bot.setVelocity(crab_velocity, forward, rate);
     }
   }
 
@@ -177,14 +218,17 @@ public:
 
       unsigned long lastReorientTime = millis(); // Initialize the timer
       while (
-        (leftSonic.getDistance() >= MEAN_DISTANCE) ||
-        (rightSonic.getDistance() >= MEAN_DISTANCE)){
+        (leftSonic.getFilteredDistance(SONAR_MAX_AGE) >= MEAN_DISTANCE) ||
+        (rightSonic.getFilteredDistance(SONAR_MAX_AGE) >= MEAN_DISTANCE)){
         bot.move(UP,FORWARD_SPEED);
 
+        // A gap already seen in the wall ahead can be driven to directly
+        if (USE_GAP_PLANNER && updateMap() && planGap()) return PLAN_GAP;
+
         if (
           (millis() - lastReorientTime >= REORIENT_TIME) &&
-          (GAP_DISTANCE >= leftSonic.getDistance())
-          && (GAP_DISTANCE >= rightSonic.getDistance())) {
+          (GAP_DISTANCE >= leftSonic.getFilteredDistance(SONAR_MAX_AGE))
+          && (GAP_DISTANCE >= rightSonic.getFilteredDistance(SONAR_MAX_AGE))) {
             
           become_perpendicular();
           lastReorientTime = millis(); // Reset the timer
@@ -192,6 +236,13 @@ public:
       }
       // Now we're close to the wall. Straighten out.
       become_perpendicular();
+      registerWall();
+      if (USE_GAP_PLANNER) {
+        updateMap();
+        if (planGap()) return PLAN_GAP;
+        // No gap seen yet, so search along the side where less of the wall has been seen
+        return (gap.side < 0) ? SEARCH_LEFT : SEARCH_RIGHT;
+      }
       if (current_horizontal_search == RIGHT) {
         return SEARCH_LEFT;
       } else {
@@ -210,6 +261,154 @@ public:
     }
   }
 
+  /**
+   * @brief Drives diagonally to just in front of the planned gap.
+   *
+   * The gap is re-planned as the sonars fill in more of the map on the way, and the path
+   * is restarted if its middle moves by a cell or more.
+   * @return The SEARCH_FORWARD state, to drive through the gap to the next wall.
+   */
+  ObstacleFlag driveToGap(){
+    Serial.println("==== Driving To Gap ====");
+    Serial.print("Gap | x: ");
+    Serial.print(gap.gap_x);
+    Serial.print(" cm | Width: ");
+    Serial.print(gap.gap_width);
+    Serial.print(" cm | Wall y: ");
+    Serial.println(gap.wall_y);
+
+    // The map is aligned with the pose frame, so its walls face heading 0
+    if (!wall_known) {
+      wall = {0, gap.wall_y};
+      wall_known = true;
+    }
+
+    cm target_x = gap.gap_x;
+    bot.translateTo(target_x, gapApproachY(), GAP_PATH_SPEED);
+    while (!bot.updateMotion()) {
+      correctPose();
+      if (updateMap() && planGap() && fabs(gap.gap_x - target_x) >= grid.cell_size) {
+        target_x = gap.gap_x;
+        bot.translateTo(target_x, gapApproachY(), GAP_PATH_SPEED);
+      }
+    }
+
+    last_wall_y = gap.wall_y;
+    obstacles_cleared += 1;
+    wall_known = false;
+    return SEARCH_FORWARD;
+  }
+
+  /**
+   * @brief Adds any new sonar readings to the map at the current pose.
+   * @return True if a reading was added.
+   */
+  bool updateMap() {
+    bot.updatePose();
+    float c = cos(bot.pose.heading);
+    float s = sin(bot.pose.heading);
+
+    bool added = false;
+    for (int i = 0; i < 3; i++) {
+      float range;
+      unsigned long age;
+      bool valid;
+      uint32_t count = sonar(i).getLatest(range, age, valid);
+      if (count == mapped_readings[i]) continue;
+      mapped_readings[i] = count;
+
+      cm x = bot.pose.x + sonarMountX(i) * c - SONAR_OFFSET * s;
+      cm y = bot.pose.y + sonarMountX(i) * s + SONAR_OFFSET * c;
+      grid.insert(x, y, bot.pose.heading, range, valid);
+      added = true;
+    }
+    return added;
+  }
+
+  /**
+   * @brief Takes the wall in front of the robot as the reference for pose corrections.
+   *
+   * The robot should be square to the wall, so the wall's heading is the nearest multiple
+   * of 90 degrees to the robot's.
+   */
+  void registerWall() {
+    bot.updatePose();
+    float wall_heading = roundf(bot.pose.heading / HALF_PI) * HALF_PI;
+    middleSonic.waitForReading(SONAR_WAIT);
+    wall = bot.pose.wallFromRange(0, SONAR_OFFSET, middleSonic.getFilteredDistance(SONAR_MAX_AGE), wall_heading);
+    wall_known = true;
+  }
+
+  /**
+   * @brief Corrects the pose with any new sonar ranges to the registered wall.
+   */
+  void correctPose() {
+    if (!USE_WALL_CORRECTION || !wall_known) return;
+    bot.updatePose();
+    for (int i = 0; i < 3; i++) {
+      float range;
+      unsigned long age;
+      bool valid;
+      uint32_t count = sonar(i).getLatest(range, age, valid);
+      if (count == corrected_readings[i]) continue;
+      corrected_readings[i] = count;
+
+      // Long ranges are more likely a gap or the next wall than this one
+      if (!valid || range > WALL_CORRECTION_RANGE) continue;
+      bot.pose.correctRange(wall, sonarMountX(i), SONAR_OFFSET, range, SONAR_RANGE_NOISE);
+    }
+  }
+
+  /**
+   * @brief Gets a sonar by index, left to right.
+   */
+  UltraSonic& sonar(int i) {
+    return (i == 0) ? leftSonic : (i == 1) ? middleSonic : rightSonic;
+  }
+
+  /**
+   * @brief Gets how far a sonar sits to the right of the robot's centre, by index.
+   */
+  cm sonarMountX(int i) {
+    return (i - 1) * SONAR_SPACING/2;
+  }
+
+  /**
+   * @brief Plans against the map for a gap in a wall not yet passed.
+   *
+   * Nothing is planned until the robot's rear edge is through the last wall, so the
+   * diagonal path to the next gap can't swing the sides into the edges of this one.
+   * @return True if a gap was found, in gap.
+   */
+  bool planGap() {
+    if (bot.pose.y - VERTICAL_BOT_LENGTH / 2 < last_wall_y + wallDepth()) return false;
+    cm front_x, front_y;
+    frontPosition(front_x, front_y);
+    return planner.plan(grid, front_x, front_y, gap) && gap.wall_y > last_wall_y + grid.cell_size;
+  }
+
+  /**
+   * @brief Gets the depth of wall the planner checks for a gap, taken as the wall's thickness.
+   */
+  cm wallDepth() {
+    return planner.wall_rows * grid.cell_size;
+  }
+
+  /**
+   * @brief Gets the pose of the middle of the robot's front edge.
+   */
+  void frontPosition(cm& x, cm& y) {
+    x = bot.pose.x - SONAR_OFFSET * sin(bot.pose.heading);
+    y = bot.pose.y + SONAR_OFFSET * cos(bot.pose.heading);
+  }
+
+  /**
+   * @brief Gets the pose y to stop at in front of the planned gap, MIN_DISTANCE from the wall.
+   */
+  cm gapApproachY() {
+    return max(bot.pose.y, gap.wall_y - MIN_DISTANCE - SONAR_OFFSET);
+  }
+
   /**
    * @brief Handles the detection of a "green" end signal, concluding the search.
    * @return The FOUND_END state.
@@ -218,11 +417,24 @@ public:
     Serial.println("==== Found Green ====");
 
     Serial.println("END SEARCHING, GREEN FOUND");
+    Serial.print("Course time | ");
+    Serial.print(millis() - course_start_time);
+    Serial.println(" ms");
     bot.translate(UP,FORWARD_SPEED,VERTICAL_BOT_LENGTH);
     endProgram();
     return FOUND_END;
   }
 
+  /**
+   * @brief Prints how many sonar reads reused a recent reading since the last call.
+   */
+  void printSonarStats() {
+    for (UltraSonic* sonic : {&leftSonic, &middleSonic, &rightSonic}) {
+      sonic->printCacheStats();
+      sonic->resetCacheStats();
+    }
+  }
+
   /**
    * @brief Runs the obstacle avoidance process, transitioning between different states.
    */
@@ -230,6 +442,16 @@ public:
 
     leftColor.moving_average_window = 8;
     rightColor.moving_average_window = 8;
+
+    if (course_start_time == 0) {
+      // The map starts at the starting line, and nothing behind the robot is a wall to pass
+      course_start_time = millis();
+      bot.updatePose();
+      grid.initialize(bot.pose.x, bot.pose.y);
+      last_wall_y = bot.pose.y - VERTICAL_BOT_LENGTH / 2 - wallDepth();
+      // A managed sonar only gets a new reading once a cycle, so anything shorter waits for it
+      SONAR_MAX_AGE = max(SONAR_MAX_AGE, sonarManager.cycleTime());
+    }
     
     switch (obstacle_flag) {
       case SEARCH_RIGHT:
@@ -241,9 +463,13 @@ public:
       case SEARCH_FORWARD:
         obstacle_flag = searchForward();
         break;
+      case PLAN_GAP:
+        obstacle_flag = driveToGap();
+        break;
       case FOUND_END:
         obstacle_flag = foundGreen();
     }
+    if (debug) printSonarStats();
   }
 };
 
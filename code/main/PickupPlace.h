@@ -16,6 +16,7 @@
 #include "BoxControl.h"       // Controls for the object manipulation
 #include "LineFollowing.h"    // Line following functionalities
 #include "Motion.h"           // Basic motion control
+#include "controls/ApproachController.h" // Sonar braking profile for approaches
 
 /**
  * @class PickupPlace
@@ -31,15 +32,23 @@ class PickupPlace {
 public:
   float background_distance = 45;          ///< Max range for Ultrasonic sensors.
   float i_beam_approach_distance = 15;     ///< Distance for stopping at platform.
-  float i_beam_approach_speed = 70;        ///< Speed to approach the platforms.
+  float i_beam_approach_speed = 100;       ///< PWM the platform approach cruises at before braking.
   float starting_line_catch_speed = 80;    ///< Initial speed to locate the starting line.
   int window_size = 4;                     ///< Moving average window size for readings.
 
   float following_speed = 70;              ///< Standard speed for following lines.
   float horizontal_centering_speed = 70;   ///< Speed for horizontal adjustments.
+  cm fork_search_distance = 30;            ///< Farthest the fork search drives sideways before giving up.
+  bool pipelined_pickup = true;            ///< Overlap the approach, grab and departure in pickup().
+  float reach_distance = 10;               ///< Start lowering the arm this far before the approach stops.
+
+  unsigned long coast_time = 250;          ///< Time to watch the robot coast after an approach, in ms.
+  unsigned long approach_timeout = 8000;   ///< Longest an approach may drive and coast before giving up, in ms.
+  ApproachController approach;             ///< Braking profile shared by both platform approaches.
 
   IRLineFollower quickFollower;            ///< Faster, less precise line following.
   IRLineFollower carefulFollower;          ///< More careful, precise line following.
+  LineTracker boxTracker;                  ///< Centred line following on the box's line, where lines aren't caught.
 
   /**
    * @brief Constructs and configures two types of line followers: quick and careful.
@@ -65,20 +74,155 @@ public:
     carefulFollower.reverse_wheels = true;
   }
 
+  /**
+   * @brief Drives towards the object ahead until the middle sonar reaches
+   * i_beam_approach_distance, slowing down on the measured braking profile.
+   *
+   * After stopping, the sonar watches the robot coast for coast_time, and the coast
+   * distance updates the braking estimate for the next approach. Pings with no echo
+   * report the sonar's max range, so they are skipped and the last speed is held rather
+   * than mistaking them for open floor ahead; until the first echo that speed is
+   * cruise_speed. If approach_timeout passes first, the robot stops and the braking
+   * estimate is left alone.
+   * @param cruise_speed The fastest speed to approach at in cm/sec.
+   * @param drive Drives the robot forward at a speed in cm/sec for one loop iteration.
+   * @param onRange Called with the filtered range every iteration, or nullptr.
+   */
+  void profiledApproach(cm_per_sec cruise_speed, std::function<void(cm_per_sec)> drive,
+                        std::function<void(float)> onRange = nullptr) {
+    approach.initialize(i_beam_approach_distance, cruise_speed);
+    cm_per_sec stop_speed = 0;
+    float range;
+    unsigned long age;
+    bool valid;
+    bool timed_out = false;
+    unsigned long startTime = millis();
+    while (true) {
+      middleSonic.getDistance();
+      middleSonic.getLatest(range, age, valid);
+      cm_per_sec held_speed = approach.initialized ? approach.speed : cruise_speed;
+      cm_per_sec speed = valid ? approach.update(range, middleSonic.getReadingTime()) : held_speed;
+      if (onRange) onRange(approach.range);
+      if (approach.done()) break;
+      if (millis() - startTime >= approach_timeout) {
+        timed_out = true;
+        break;
+      }
+      drive(speed);
+      stop_speed = speed;
+    }
+    float stop_range = approach.range;
+    bot.stopMotion();
+
+    float coast_range = stop_range;
+    unsigned long stopTime = millis();
+    while (!timed_out && millis() - stopTime < coast_time) {
+      middleSonic.getDistance();
+      middleSonic.getLatest(range, age, valid);
+      if (valid) coast_range = range;
+      servos.update(millis());
+      timed_out = millis() - startTime >= approach_timeout;
+    }
+    bot.stopMotion();
+    if (timed_out) {
+      // The stop wasn't on the profile, or the coast was cut short, so there's nothing to learn
+      Serial.println("Approach timed out, braking estimate unchanged.");
+      return;
+    }
+    approach.learnBraking(stop_speed, stop_range - coast_range);
+    approach.printout();
+  }
+
   /**
    * @brief Moves the robot towards the platform until it reaches the specified
    * i_beam_approach_distance.
    * 
-   * Uses ultrasonic sensors to measure distance to the platform and moves forward until
-   * the distance is less than the threshold.
+   * Uses ultrasonic sensors to measure distance to the platform and approaches at full
+   * speed, braking on the profile so it stops at the threshold.
    */
   void approachPlatform(){
     Serial.println("== Approaching Platform ==");
-    // While the left sonic distance is greater than the trigger, keep moving forwards.
-    while (middleSonic.getDistance() > i_beam_approach_distance){
-      bot.move(UP, i_beam_approach_speed);
+    profiledApproach(maxApproachSpeed(), [](cm_per_sec speed) {
+      bot.setVelocity(0, speed, 0);
+    });
+  }
+
+  /**
+   * @brief Gets the speed both forward wheels can hold at i_beam_approach_speed.
+   * @return The speed in cm/sec.
+   */
+  cm_per_sec maxApproachSpeed() {
+    return min(leftMotor.getSpeed(i_beam_approach_speed), rightMotor.getSpeed(i_beam_approach_speed));
+  }
+
+  /**
+   * @brief Prints how long a phase took and starts timing the next one.
+   * @param name The phase that just finished.
+   * @param phaseStart Start time of the phase in ms, reset to now.
+   */
+  void logPhase(const char* name, unsigned long& phaseStart) {
+    unsigned long now = millis();
+    Serial.print("Phase time | ");
+    Serial.print(name);
+    Serial.print(": ");
+    Serial.print(now - phaseStart);
+    Serial.println(" ms");
+    phaseStart = now;
+  }
+
+  /**
+   * @brief Approaches the platform, procures the box, and returns to the green line.
+   *
+   * With pipelined_pickup, the stages overlap: the arm lowers during the last
+   * reach_distance of the approach, the gripper color is sampled while the jaws close,
+   * and the robot reverses towards the green line while the arm lifts. Each phase's
+   * time is logged either way, so the two modes can be compared.
+   */
+  void pickup() {
+    unsigned long start = millis();
+    unsigned long phaseStart = start;
+
+    if (!pipelined_pickup) {
+      approachPlatform();
+      logPhase("Approach", phaseStart);
+      box.procure();
+      logPhase("Procure", phaseStart);
+      orientOnGreenLine();
+      logPhase("Orient on green line", phaseStart);
+    } else {
+      Serial.println("== Approaching Platform (pipelined) ==");
+      bool reaching = false;
+      profiledApproach(maxApproachSpeed(), [](cm_per_sec speed) {
+        bot.setVelocity(0, speed, 0);
+        servos.update(millis());
+      }, [this, &reaching](float range) {
+        if (!reaching && range <= i_beam_approach_distance + reach_distance) {
+          box.startReach();
+          reaching = true;
+        }
+      });
+      logPhase("Approach", phaseStart);
+
+      if (!reaching) {
+        box.startReach();
+      }
+      servos.wait();
+      logPhase("Reach", phaseStart);
+
+      box._grab(true);
+      box._getColor();
+      box._getSize();
+      logPhase("Grab and identify", phaseStart);
+
+      box.startPickup();
+      orientOnGreenLine(); // Ticks the servos, so the arm lifts on the way
+      servos.wait();
+      logPhase("Lift and orient on green line", phaseStart);
     }
-    bot.stopMotion();
+
+    Serial.print("Phase time | Pickup total: ");
+    Serial.print(millis() - start);
+    Serial.println(" ms");
   }
 
   /**
@@ -95,6 +239,7 @@ public:
     // Keep moving down until we see the green starting
     while (!((leftColor.getColor() == GREEN) || (rightColor.getColor () == GREEN))) {
       bot.move(DOWN, starting_line_catch_speed);
+      servos.update(millis()); // Lets a pipelined pickup lift the arm on the way
     }
 
     // Center on the green line in the direction related to the box color.
@@ -181,9 +326,12 @@ public:
 
     // Once the left and right and middle are reading green, stop the cart, indicating the line has been found.
     irArray.setColor(box.color);
+    // Ramp the wheels so the fast corrections don't slip them or pitch the color sensors.
+    bot.setSlewLimited(true);
     while (!((leftColor.getColor() == GREEN) && (rightColor.getColor() == GREEN) && (middleColor.getColor() == GREEN))){
       quickFollower.follow(box.color);
     }
+    bot.setSlewLimited(false); // Stop on the green line without ramping down
     bot.stopMotion();
   }
 
@@ -213,10 +361,10 @@ public:
     leftColor.clearColorHistory();  // Clear as this is a new operation.
     rightColor.clearColorHistory();  // Clear as this is a new operation.
     irArray.setColor(box.color);
-    carefulFollower.if_catch_lines = false; // We don't want drastic movements, we want to be centered.
     // Keep following the line until both sensors are the line color. This indicates a fork.
+    boxTracker.initialize();
     while (((leftColor.getColor() != box.color) && (rightColor.getColor() != box.color))){
-      carefulFollower.follow(box.color);
+      boxTracker.follow(box.color);
     }
     // We need to clear the line so we can see with our middle sensor again.
     bot.translate(UP, 100, VERTICAL_BOT_LENGTH/2);
@@ -243,25 +391,33 @@ public:
         middleColor.getColor();
     }
 
-    // While the middle sensor isn't reading the line color, move in that direction.
-    if (box.size == LARGE) {
-      // If the box is large, go to the lefthand line
-      Serial.println("Searching left on the fork...");
-      while (middleColor.getColor() != box.color){
-        bot.move(LEFT, horizontal_centering_speed);
-      }
-      // Shimmy slightly as the middle sensor will read the color on the edge of the tape. THis centers it.
-      bot.translate(LEFT, horizontal_centering_speed,2);
-    }
-    else if (box.size == SMALL) {
-      // If the box is small, go to the righthand line
-      Serial.println("Searching right on the fork...");
-      while(middleColor.getColor() != box.color){
-        bot.move(RIGHT, horizontal_centering_speed);
-      }
-      // Shimmy slightly as the middle sensor will read the color on the edge of the tape. THis centers it.
-      bot.translate(RIGHT, horizontal_centering_speed, 2);
+    // If the box is large, go to the lefthand line, if it's small, the righthand one
+    Cardinal direction = LEFT;
+    switch (box.size) {
+      case LARGE:
+        direction = LEFT;
+        break;
+      case SMALL:
+        direction = RIGHT;
+        break;
     }
+    Serial.println((direction == LEFT) ? "Searching left on the fork..." : "Searching right on the fork...");
+    cm_per_sec speed = (topMotor.getSpeed(horizontal_centering_speed) + bottomMotor.getSpeed(horizontal_centering_speed)) / 2;
+
+    // While the middle sensor isn't reading the line color, move in that direction. Give up
+    // after fork_search_distance, so a missed line can't leave the queue running.
+    bool found = false;
+    float start_x = bot.pose.x;
+    float start_y = bot.pose.y;
+    bot.queueVelocity({(direction == LEFT) ? -speed : speed, 0, 0}, [&]() {
+      found = middleColor.getColor() == box.color;
+      return found || hypot(bot.pose.x - start_x, bot.pose.y - start_y) >= fork_search_distance;
+    });
+    // Shimmy slightly as the middle sensor will read the color on the edge of the tape. This
+    // centers it, and carries on from the search without stopping in between.
+    bot.queueTranslate(direction, 2, speed, true);
+    bot.runQueue();
+    if (!found) Serial.println("Fork line not found within the search distance.");
 
     middleColor.moving_average_window = window_size;
     bot.stopMotion();
@@ -281,11 +437,11 @@ public:
     stop once we've found it.
     */
 
-    // While the platform ir sensor isn't reading, follow the line and move forward.
-    while (middleSonic.getDistance() >= i_beam_approach_distance) {
-      carefulFollower.follow(box.color);
-    }
-    bot.stopMotion();
+    // Follow the line forward at the speed on the braking profile.
+    boxTracker.initialize();
+    profiledApproach(boxTracker.speed, [this](cm_per_sec speed) {
+      boxTracker.follow(box.color, speed);
+    });
   }
 
   /**
@@ -327,8 +483,9 @@ public:
     // While the platform ir sensor isn't reading, follow the line and move forward.
     leftColor.clearColorHistory();
     rightColor.clearColorHistory();
+    boxTracker.initialize();
     while ((leftColor.getColor() != box.color) && (rightColor.getColor() != box.color)) {
-      carefulFollower.follow(box.color);
+      boxTracker.follow(box.color);
     }
     bot.stopMotion();
     bot.translate(UP, 100, VERTICAL_BOT_LENGTH/2);
@@ -364,10 +521,8 @@ public:
   void run(){
     Serial.println("| ==== Running Pickup & Place ==== |"); 
     // Runs all of the functions in order
-    approachPlatform();         // Moves on the y axis until it gets close to the platform.
-    box.procure();              // Grab, get properties, and raise the box.
-
-    orientOnGreenLine();        // Drive back until the starting green line, then rotate to the colored line
+    pickup();                   // Approach the platform, grab, get properties, and raise the box,
+                                // then drive back until the starting green line
     goToStartingLine();         // Drive until the colored line to follow is found
     orientOnStartingLine();     // Orient so the bot is parallel with the follow line
     followUntilGreen();         // Follow the colored line until the green line designates termination
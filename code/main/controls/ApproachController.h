@@ -0,0 +1,134 @@
+#ifndef APPROACH_CONTROLLER_H
+#define APPROACH_CONTROLLER_H
+// =====================
+
+/**
+ * @file ApproachController.h
+ * @brief Defines the ApproachController class for sonar guided stops in front of an object.
+ *
+ * This file contains the definition of the ApproachController class, which filters the
+ * sonar range with an alpha-beta filter to get a smooth range and range rate, and
+ * commands a forward speed that follows the braking curve v = sqrt(2 a (r - standoff)).
+ * The deceleration a is the robot's own braking, measured from how far it coasts after
+ * each stop, so the approach can start at full speed and still stop at the standoff.
+ */
+
+#include <Arduino.h>
+
+class ApproachController {
+  public:
+    float standoff = 15;         ///< Range to stop at in cm.
+    float max_speed = 30;        ///< Cruise speed far from the target in cm/sec.
+    float min_speed = 4;         ///< Slowest commanded speed, so the wheels don't stall.
+    float braking = 60;          ///< Deceleration the profile plans for in cm/sec^2.
+    float braking_margin = 0.7;  ///< Fraction of the measured braking the profile uses.
+    float braking_weight = 0.5;  ///< Weight of each new braking measurement.
+    float min_braking = 20;      ///< Lower bound on the measured braking in cm/sec^2.
+    float max_braking = 400;     ///< Upper bound on the measured braking in cm/sec^2.
+    float coast_resolution = 1;  ///< Shortest coast the sonar can resolve in cm.
+    float braking_growth = 0.2;  ///< Fraction a clean stop raises the braking target by.
+    float alpha = 0.5;           ///< Range correction gain of the alpha-beta filter.
+    float beta = 0.1;            ///< Rate correction gain of the alpha-beta filter.
+
+    float range = 0;             ///< Filtered range in cm.
+    float rate = 0;              ///< Filtered range rate in cm/sec, negative when closing.
+    float speed = 0;             ///< Last commanded speed in cm/sec.
+    unsigned long lastTime = 0;  ///< Time of the last range in ms.
+    bool initialized = false;    ///< False until the first range is seen.
+
+    /**
+     * @brief Starts a new approach.
+     *
+     * @param target_standoff The range to stop at in cm.
+     * @param cruise_speed The fastest speed to approach at in cm/sec.
+     */
+    void initialize(float target_standoff, float cruise_speed) {
+      standoff = target_standoff;
+      max_speed = cruise_speed;
+      rate = 0;
+      speed = 0;
+      initialized = false;
+    }
+
+    /**
+     * @brief Filters a new range reading and works out the speed to drive at.
+     *
+     * @param measured The raw sonar range in cm.
+     * @param now The time of the reading in ms.
+     * @return The forward speed to command in cm/sec, 0 once at the standoff.
+     */
+    float update(float measured, unsigned long now) {
+      if (!initialized) {
+        range = measured;
+        rate = 0;
+        lastTime = now;
+        initialized = true;
+      } else {
+        float dt = (now - lastTime) / 1000.0;
+        lastTime = now;
+        if (dt > 0) {
+          float predicted = range + rate * dt;
+          float residual = measured - predicted;
+          range = predicted + alpha * residual;
+          rate += beta * residual / dt;
+        }
+      }
+
+      float remaining = range - standoff;
+      if (remaining <= 0) {
+        speed = 0;
+      } else {
+        float profile = sqrtf(2 * braking * braking_margin * remaining);
+        speed = max(min_speed, min(max_speed, profile));
+      }
+      return speed;
+    }
+
+    /**
+     * @brief Checks whether the robot has reached the standoff.
+     *
+     * @return True once the filtered range is at or inside the standoff.
+     */
+    bool done() const {
+      return initialized && range <= standoff;
+    }
+
+    /**
+     * @brief Updates the braking estimate from a stop.
+     *
+     * The estimate moves part way towards stop_speed^2 / (2 coast), so a long coast lowers
+     * it and a short one raises it. A coast too short for the sonar to resolve only says
+     * the braking is at least stop_speed^2 / (2 coast_resolution). At the slow stop speeds
+     * near the standoff that bound is usually below the estimate, so a clean stop instead
+     * raises the target by braking_growth. Without this the estimate could only drift
+     * down over a run. If it grows too far, the next stop coasts and pulls it back.
+     *
+     * @param stop_speed The speed commanded when the motors stopped, in cm/sec.
+     * @param coast_distance How far it travelled after that, in cm.
+     */
+    void learnBraking(float stop_speed, float coast_distance) {
+      if (stop_speed <= 0) return;
+      float measured;
+      if (coast_distance > coast_resolution) {
+        measured = stop_speed * stop_speed / (2 * coast_distance);
+      } else {
+        measured = max(stop_speed * stop_speed / (2 * coast_resolution), braking * (1 + braking_growth));
+      }
+      braking += braking_weight * (constrain(measured, min_braking, max_braking) - braking);
+    }
+
+    /**
+     * @brief Prints the filter state and braking estimate to the serial monitor.
+     */
+    void printout() {
+      Serial.print("Range: ");
+      Serial.print(range);
+      Serial.print(" cm | Rate: ");
+      Serial.print(rate);
+      Serial.print(" cm/s | Braking: ");
+      Serial.print(braking);
+      Serial.println(" cm/s^2");
+    }
+};
+
+#endif // APPROACH_CONTROLLER_H
@@ -0,0 +1,123 @@
+#ifndef CALIBRATION_LOOKUP_H
+#define CALIBRATION_LOOKUP_H
+// =====================
+
+/**
+ * @file CalibrationLookup.h
+ * @brief Defines the CalibrationLookup class for constant time piecewise-linear lookups.
+ *
+ * This file contains the definition of the CalibrationLookup class, which precompiles a
+ * table of (x, y) calibration points into float32 segments with precomputed slopes and a
+ * uniform grid over x. Each grid cell stores the first segment it overlaps, so a lookup
+ * is one multiply to find the cell and at most a step or two to reach the segment,
+ * instead of a linear scan over the whole table.
+ */
+
+#include <Arduino.h>
+
+#define CALIBRATION_LOOKUP_MAX_POINTS 32 ///< Largest calibration table that can be compiled.
+#define CALIBRATION_LOOKUP_GRID_CELLS 32 ///< Number of uniform cells spanning the table's x range.
+
+class CalibrationLookup {
+  public:
+    int count = 0;                                    ///< Number of points kept from the table
+    float xs[CALIBRATION_LOOKUP_MAX_POINTS];          ///< Breakpoints, strictly increasing
+    float ys[CALIBRATION_LOOKUP_MAX_POINTS];          ///< Value at each breakpoint
+    float slopes[CALIBRATION_LOOKUP_MAX_POINTS];      ///< Slope of the segment starting at each breakpoint
+    uint8_t grid[CALIBRATION_LOOKUP_GRID_CELLS + 1];  ///< First segment overlapping each cell
+    float inverseCellWidth = 0;                       ///< Grid cells per unit of x
+
+    /**
+     * @brief Compiles a calibration table into the lookup.
+     *
+     * Points must be sorted by x. Points that don't increase x are skipped, and anything
+     * past CALIBRATION_LOOKUP_MAX_POINTS is ignored.
+     *
+     * @param x The input value of each calibration point.
+     * @param y The output value of each calibration point.
+     * @param n Number of calibration points.
+     */
+    void build(const float* x, const float* y, int n) {
+      count = 0;
+      for (int i = 0; i < n && count < CALIBRATION_LOOKUP_MAX_POINTS; i++) {
+        if (count > 0 && x[i] <= xs[count - 1]) continue;
+        xs[count] = x[i];
+        ys[count] = y[i];
+        count++;
+      }
+
+      for (int i = 0; i + 1 < count; i++) {
+        slopes[i] = (ys[i + 1] - ys[i]) / (xs[i + 1] - xs[i]);
+      }
+      if (count > 0) {
+        slopes[count - 1] = (count > 1) ? slopes[count - 2] : 0;
+      }
+
+      if (count < 2) {
+        inverseCellWidth = 0;
+        memset(grid, 0, sizeof(grid));
+        return;
+      }
+
+      inverseCellWidth = CALIBRATION_LOOKUP_GRID_CELLS / (xs[count - 1] - xs[0]);
+      int segment = 0;
+      for (int cell = 0; cell <= CALIBRATION_LOOKUP_GRID_CELLS; cell++) {
+        float cellStart = xs[0] + cell / inverseCellWidth;
+        while (segment < count - 2 && cellStart >= xs[segment + 1]) {
+          segment++;
+        }
+        grid[cell] = segment;
+      }
+    }
+
+    /**
+     * @brief Checks whether a table has been compiled.
+     *
+     * @return True if there's at least one point to interpolate from.
+     */
+    bool empty() const {
+      return count == 0;
+    }
+
+    /**
+     * @brief Smallest x covered by the table.
+     */
+    float minInput() const {
+      return xs[0];
+    }
+
+    /**
+     * @brief Largest x covered by the table.
+     */
+    float maxInput() const {
+      return xs[count - 1];
+    }
+
+    /**
+     * @brief Interpolates the table at x.
+     *
+     * Below the table the first value is returned. Above the table the last segment is
+     * extrapolated, so callers should clamp the result to whatever range is physical.
+     *
+     * @param x The input value.
+     * @return The interpolated output value.
+     */
+    float evaluate(float x) const {
+      if (count == 0) return 0;
+      if (x <= xs[0]) return ys[0];
+
+      int segment = count - 1;
+      if (x < xs[count - 1]) {
+        segment = grid[(int)((x - xs[0]) * inverseCellWidth)];
+        while (segment > 0 && x < xs[segment]) {
+          segment--;  // Only reachable through float rounding at a cell edge
+        }
+        while (x > xs[segment + 1]) {
+          segment++;
+        }
+      }
+      return ys[segment] + slopes[segment] * (x - xs[segment]);
+    }
+};
+
+#endif // CALIBRATION_LOOKUP_H
@@ -0,0 +1,318 @@
+#ifndef DSP_KERNELS_H
+#define DSP_KERNELS_H
+// =====================
+
+/**
+ * @file DSPKernels.h
+ * @brief Packed 16-bit kernels for the IR array and color sensor hot loops.
+ *
+ * This file contains small integer kernels used by the IR sensor array and the color
+ * sensors: a moving-average update, a weighted centroid, and a nearest-neighbour search
+ * over a table of RGB calibration points. On the Teensy 4.1 (Cortex-M7) they use the
+ * packed 16-bit DSP instructions (SADD16, SSUB16, SMLAD, SMUAD), which process two
+ * samples per instruction. Other targets use AVX2 when it is available and a plain
+ * scalar loop otherwise. The scalar versions are always compiled so the packed paths
+ * can be benchmarked against them with dspBenchmark() (uncomment its line in setup()).
+ */
+
+#include <Arduino.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__ARM_FEATURE_SIMD32)
+#include <arm_acle.h>
+#define DSP_KERNELS_PACKED_ARM
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#define DSP_KERNELS_AVX2
+#endif
+
+#define DSP_WEIGHT_ONE 16384   ///< Fixed point 1.0 (Q14) for centroid weights.
+#define DSP_COLOR_MAX 16383    ///< Largest channel value kept in a color table.
+#define DSP_COLOR_STRIDE 4     ///< int16 lanes per color table row (R, G, B, 0).
+
+/**
+ * @brief Scalar reference for dspMovingAverageUpdate().
+ */
+void dspMovingAverageUpdateScalar(int16_t* sums, int16_t* slot, const int16_t* samples, int count) {
+  for (int i = 0; i < count; i++) {
+    sums[i] += samples[i] - slot[i];
+    slot[i] = samples[i];
+  }
+}
+
+/**
+ * @brief Scalar reference for dspWeightedCentroid().
+ */
+void dspWeightedCentroidScalar(const int16_t* mask, const int16_t* weights, const int16_t* units,
+                               int count, int32_t& weight_sum, int32_t& hit_count) {
+  weight_sum = 0;
+  hit_count = 0;
+  for (int i = 0; i < count; i++) {
+    weight_sum += mask[i] * weights[i];
+    hit_count += mask[i] * units[i];
+  }
+}
+
+/**
+ * @brief Scalar reference for dspNearestColor().
+ */
+int dspNearestColorScalar(const int16_t* table, int points, const int16_t sample[3],
+                          uint32_t& best_distance_sq) {
+  int best_index = -1;
+  best_distance_sq = UINT32_MAX;
+  for (int p = 0; p < points; p++) {
+    const int16_t* row = table + p * DSP_COLOR_STRIDE;
+    int32_t dr = row[0] - sample[0];
+    int32_t dg = row[1] - sample[1];
+    int32_t db = row[2] - sample[2];
+    uint32_t distance_sq = dr * dr + dg * dg + db * db;
+    if (distance_sq < best_distance_sq) {
+      best_distance_sq = distance_sq;
+      best_index = p;
+    }
+  }
+  return best_index;
+}
+
+/**
+ * @brief Replaces the oldest sample in a moving-average window and updates the running sums.
+ *
+ * For every channel: sums += samples - slot, then slot = samples. The sums must fit in
+ * an int16, i.e. window size * largest sample <= 32767.
+ *
+ * @param sums Running window sums, one per channel.
+ * @param slot The window slot being overwritten (holds the oldest samples).
+ * @param samples The new samples.
+ * @param count Number of channels.
+ */
+void dspMovingAverageUpdate(int16_t* sums, int16_t* slot, const int16_t* samples, int count) {
+  int i = 0;
+#if defined(DSP_KERNELS_PACKED_ARM)
+  for (; i + 2 <= count; i += 2) {
+    int16x2_t sum, old, sample;
+    memcpy(&sum, sums + i, sizeof(sum));
+    memcpy(&old, slot + i, sizeof(old));
+    memcpy(&sample, samples + i, sizeof(sample));
+    sum = __sadd16(sum, __ssub16(sample, old));
+    memcpy(sums + i, &sum, sizeof(sum));
+    memcpy(slot + i, &sample, sizeof(sample));
+  }
+#elif defined(DSP_KERNELS_AVX2)
+  for (; i + 16 <= count; i += 16) {
+    __m256i sum = _mm256_loadu_si256((const __m256i*)(sums + i));
+    __m256i old = _mm256_loadu_si256((const __m256i*)(slot + i));
+    __m256i sample = _mm256_loadu_si256((const __m256i*)(samples + i));
+    sum = _mm256_add_epi16(sum, _mm256_sub_epi16(sample, old));
+    _mm256_storeu_si256((__m256i*)(sums + i), sum);
+    _mm256_storeu_si256((__m256i*)(slot + i), sample);
+  }
+#endif
+  dspMovingAverageUpdateScalar(sums + i, slot + i, samples + i, count - i);
+}
+
+/**
+ * @brief Computes the masked weight sum and hit count of a sensor array.
+ *
+ * weight_sum = sum(mask * weights) and hit_count = sum(mask * units). Weights are in
+ * Q14 (DSP_WEIGHT_ONE is 1.0); the mask and units are 0 or 1.
+ *
+ * @param mask Per-sensor trigger flags.
+ * @param weights Per-sensor position weights in Q14.
+ * @param units Per-sensor flag for whether a trigger counts towards hit_count.
+ * @param count Number of sensors.
+ * @param weight_sum Output sum of the triggered weights.
+ * @param hit_count Output number of triggered, counted sensors.
+ */
+void dspWeightedCentroid(const int16_t* mask, const int16_t* weights, const int16_t* units,
+                         int count, int32_t& weight_sum, int32_t& hit_count) {
+  int i = 0;
+  int32_t sum = 0;
+  int32_t hits = 0;
+#if defined(DSP_KERNELS_PACKED_ARM)
+  for (; i + 2 <= count; i += 2) {
+    int16x2_t m, w, u;
+    memcpy(&m, mask + i, sizeof(m));
+    memcpy(&w, weights + i, sizeof(w));
+    memcpy(&u, units + i, sizeof(u));
+    sum = __smlad(m, w, sum);
+    hits = __smlad(m, u, hits);
+  }
+#elif defined(DSP_KERNELS_AVX2)
+  __m256i sum_vec = _mm256_setzero_si256();
+  __m256i hit_vec = _mm256_setzero_si256();
+  for (; i + 16 <= count; i += 16) {
+    __m256i m = _mm256_loadu_si256((const __m256i*)(mask + i));
+    sum_vec = _mm256_add_epi32(sum_vec, _mm256_madd_epi16(m, _mm256_loadu_si256((const __m256i*)(weights + i))));
+    hit_vec = _mm256_add_epi32(hit_vec, _mm256_madd_epi16(m, _mm256_loadu_si256((const __m256i*)(units + i))));
+  }
+  int32_t lanes[8];
+  _mm256_storeu_si256((__m256i*)lanes, sum_vec);
+  for (int j = 0; j < 8; j++) sum += lanes[j];
+  _mm256_storeu_si256((__m256i*)lanes, hit_vec);
+  for (int j = 0; j < 8; j++) hits += lanes[j];
+#endif
+  int32_t tail_sum, tail_hits;
+  dspWeightedCentroidScalar(mask + i, weights + i, units + i, count - i, tail_sum, tail_hits);
+  weight_sum = sum + tail_sum;
+  hit_count = hits + tail_hits;
+}
+
+/**
+ * @brief Finds the color table row closest to a sample by squared Euclidean distance.
+ *
+ * The table holds DSP_COLOR_STRIDE int16 lanes per row (R, G, B, 0) with channels in
+ * [0, DSP_COLOR_MAX], which keeps the squared distance inside an int32.
+ *
+ * @param table The packed color table.
+ * @param points Number of rows in the table.
+ * @param sample The RGB sample, each channel in [0, DSP_COLOR_MAX].
+ * @param best_distance_sq Output squared distance to the closest row (UINT32_MAX if none).
+ * @return Index of the closest row, or -1 if the table is empty.
+ */
+int dspNearestColor(const int16_t* table, int points, const int16_t sample[3],
+                    uint32_t& best_distance_sq) {
+#if defined(DSP_KERNELS_PACKED_ARM)
+  int best_index = -1;
+  best_distance_sq = UINT32_MAX;
+  int16_t sample_rows[4] = {sample[0], sample[1], sample[2], 0};
+  int16x2_t sample_rg, sample_b;
+  memcpy(&sample_rg, sample_rows, sizeof(sample_rg));
+  memcpy(&sample_b, sample_rows + 2, sizeof(sample_b));
+  for (int p = 0; p < points; p++) {
+    int16x2_t row_rg, row_b;
+    memcpy(&row_rg, table + p * DSP_COLOR_STRIDE, sizeof(row_rg));
+    memcpy(&row_b, table + p * DSP_COLOR_STRIDE + 2, sizeof(row_b));
+    int16x2_t d_rg = __ssub16(row_rg, sample_rg);
+    int16x2_t d_b = __ssub16(row_b, sample_b);
+    uint32_t distance_sq = (uint32_t)__smlad(d_b, d_b, __smuad(d_rg, d_rg));
+    if (distance_sq < best_distance_sq) {
+      best_distance_sq = distance_sq;
+      best_index = p;
+    }
+  }
+  return best_index;
+#elif defined(DSP_KERNELS_AVX2)
+  int best_index = -1;
+  best_distance_sq = UINT32_MAX;
+  int p = 0;
+  uint64_t packed_sample = (uint16_t)sample[0] | ((uint64_t)(uint16_t)sample[1] << 16) |
+                           ((uint64_t)(uint16_t)sample[2] << 32);
+  __m256i sample_vec = _mm256_set1_epi64x((long long)packed_sample);
+  for (; p + 4 <= points; p += 4) {
+    __m256i rows = _mm256_loadu_si256((const __m256i*)(table + p * DSP_COLOR_STRIDE));
+    __m256i diff = _mm256_sub_epi16(rows, sample_vec);
+    int32_t lanes[8];
+    _mm256_storeu_si256((__m256i*)lanes, _mm256_madd_epi16(diff, diff));
+    for (int j = 0; j < 4; j++) {
+      uint32_t distance_sq = (uint32_t)(lanes[2 * j] + lanes[2 * j + 1]);
+      if (distance_sq < best_distance_sq) {
+        best_distance_sq = distance_sq;
+        best_index = p + j;
+      }
+    }
+  }
+  uint32_t tail_distance_sq;
+  int tail_index = dspNearestColorScalar(table + p * DSP_COLOR_STRIDE, points - p, sample,
+                                         tail_distance_sq);
+  if (tail_index >= 0 && tail_distance_sq < best_distance_sq) {
+    best_distance_sq = tail_distance_sq;
+    best_index = p + tail_index;
+  }
+  return best_index;
+#else
+  return dspNearestColorScalar(table, points, sample, best_distance_sq);
+#endif
+}
+
+/**
+ * @brief Times the selected kernels against their scalar references and prints the result.
+ *
+ * Runs each kernel on synthetic data sized like the robot's sensors (7 IR channels, a
+ * 128 row color table) and prints the total microseconds for both versions.
+ *
+ * @param iterations Number of calls to time for each kernel.
+ */
+void dspBenchmark(int iterations = 10000) {
+  const int channels = 7;
+  const int points = 128;
+  int16_t sums[channels] = {0};
+  int16_t slot[channels] = {0};
+  int16_t samples[channels];
+  int16_t weights[channels];
+  int16_t units[channels];
+  int16_t table[points * DSP_COLOR_STRIDE];
+  int16_t sample[3] = {400, 380, 450};
+  volatile int32_t sink = 0;  // Keeps the timed loops from being optimized out
+
+  for (int i = 0; i < channels; i++) {
+    samples[i] = (int16_t)(i & 1);
+    weights[i] = (int16_t)(-DSP_WEIGHT_ONE + 2 * DSP_WEIGHT_ONE * i / (channels - 1));
+    units[i] = weights[i] != 0;
+  }
+  for (int i = 0; i < points * DSP_COLOR_STRIDE; i++) {
+    table[i] = (i % DSP_COLOR_STRIDE == 3) ? 0 : (int16_t)((i * 37) % 900);
+  }
+
+  unsigned long start, packed_time, scalar_time;
+  int32_t weight_sum, hit_count;
+  uint32_t distance_sq;
+
+  Serial.println("== DSP kernel benchmark (us) ==");
+
+  start = micros();
+  for (int n = 0; n < iterations; n++) {
+    samples[n % channels] = (int16_t)(n & 1023);
+    dspMovingAverageUpdate(sums, slot, samples, channels);
+  }
+  packed_time = micros() - start;
+  start = micros();
+  for (int n = 0; n < iterations; n++) {
+    samples[n % channels] = (int16_t)(n & 1023);
+    dspMovingAverageUpdateScalar(sums, slot, samples, channels);
+  }
+  scalar_time = micros() - start;
+  sink += sums[0];
+  Serial.print("Moving average: ");
+  Serial.print(packed_time);
+  Serial.print(" | scalar: ");
+  Serial.println(scalar_time);
+
+  start = micros();
+  for (int n = 0; n < iterations; n++) {
+    samples[n % channels] = (int16_t)(n & 1);
+    dspWeightedCentroid(samples, weights, units, channels, weight_sum, hit_count);
+    sink += weight_sum + hit_count;
+  }
+  packed_time = micros() - start;
+  start = micros();
+  for (int n = 0; n < iterations; n++) {
+    samples[n % channels] = (int16_t)(n & 1);
+    dspWeightedCentroidScalar(samples, weights, units, channels, weight_sum, hit_count);
+    sink += weight_sum + hit_count;
+  }
+  scalar_time = micros() - start;
+  Serial.print("Weighted centroid: ");
+  Serial.print(packed_time);
+  Serial.print(" | scalar: ");
+  Serial.println(scalar_time);
+
+  start = micros();
+  for (int n = 0; n < iterations; n++) {
+    sample[n % 3] = (int16_t)(n % 900);
+    sink += dspNearestColor(table, points, sample, distance_sq);
+  }
+  packed_time = micros() - start;
+  start = micros();
+  for (int n = 0; n < iterations; n++) {
+    sample[n % 3] = (int16_t)(n % 900);
+    sink += dspNearestColorScalar(table, points, sample, distance_sq);
+  }
+  scalar_time = micros() - start;
+  Serial.print("Nearest color: ");
+  Serial.print(packed_time);
+  Serial.print(" | scalar: ");
+  Serial.println(scalar_time);
+}
+
+#endif // DSP_KERNELS_H
@@ -0,0 +1,265 @@
+#ifndef OCCUPANCY_GRID_H
+#define OCCUPANCY_GRID_H
+// =====================
+
+/**
+ * @file OccupancyGrid.h
+ * @brief Defines the OccupancyGrid and GapPlanner classes for planning through the obstacle course.
+ *
+ * This file contains the definition of the OccupancyGrid class, a fixed size map of the
+ * course in the pose frame (x right, y forward of the start) filled in from the sonars
+ * and the odometry, and the GapPlanner class, which finds the wall ahead of the robot in
+ * the map and the nearest gap in it. Each cell holds an 8-bit log-odds value: every
+ * sonar reading lowers the cells its beam passed through and raises the cells where it
+ * hit, so one spurious echo can't fill in a gap the robot has already seen through.
+ */
+
+#include <Arduino.h>
+#include <stdint.h>
+#include <string.h>
+
+#define OCCUPANCY_GRID_COLUMNS 64 ///< Cells across the course.
+#define OCCUPANCY_GRID_ROWS 80    ///< Cells along the course.
+#define OCCUPANCY_GRID_BEAM_RAYS 5 ///< Rays traced across each sonar beam.
+
+class OccupancyGrid {
+  public:
+    float cell_size = 5;          ///< Width of a cell in cm.
+    float origin_x = -160;        ///< Pose x of the left edge of the grid in cm.
+    float origin_y = -40;         ///< Pose y of the bottom edge of the grid in cm.
+    float beam_half_angle = 0.26; ///< Half width of the HC-SR04 beam in radians (about 15 degrees).
+    float max_range = 200;        ///< Readings are only trusted out to this range in cm.
+    float no_echo_range = 60;     ///< Range cleared by a ping with no echo in cm.
+    int8_t hit = 4;               ///< Log-odds added where a beam hit.
+    int8_t miss = -2;             ///< Log-odds added where a beam passed through.
+    int8_t limit = 40;            ///< Largest log-odds magnitude, so cells can still change their mind.
+    int8_t occupied_threshold = 10; ///< Log-odds at or above which a cell is occupied.
+    int8_t free_threshold = -4;   ///< Log-odds at or below which a cell is free.
+
+    int8_t cells[OCCUPANCY_GRID_ROWS][OCCUPANCY_GRID_COLUMNS]; ///< Log-odds, 0 for unknown.
+
+    /**
+     * @brief Clears the grid and centres it across a starting position.
+     *
+     * @param x Pose x of the start in cm.
+     * @param y Pose y of the start in cm.
+     */
+    void initialize(float x, float y) {
+      origin_x = x - OCCUPANCY_GRID_COLUMNS * cell_size / 2;
+      origin_y = y - 8 * cell_size;
+      memset(cells, 0, sizeof(cells));
+    }
+
+    /**
+     * @brief Finds the cell holding a point.
+     *
+     * @return False if the point is off the grid.
+     */
+    bool toCell(float x, float y, int& column, int& row) const {
+      column = (int)floorf((x - origin_x) / cell_size);
+      row = (int)floorf((y - origin_y) / cell_size);
+      return column >= 0 && column < OCCUPANCY_GRID_COLUMNS && row >= 0 && row < OCCUPANCY_GRID_ROWS;
+    }
+
+    /**
+     * @brief Gets the pose x of the centre of a column in cm.
+     */
+    float columnX(int column) const {
+      return origin_x + (column + 0.5) * cell_size;
+    }
+
+    /**
+     * @brief Gets the pose y of the centre of a row in cm.
+     */
+    float rowY(int row) const {
+      return origin_y + (row + 0.5) * cell_size;
+    }
+
+    /**
+     * @brief Checks whether a cell has been hit often enough to count as a wall.
+     */
+    bool isOccupied(int column, int row) const {
+      return cells[row][column] >= occupied_threshold;
+    }
+
+    /**
+     * @brief Checks whether beams have passed through a cell often enough to count as open.
+     */
+    bool isFree(int column, int row) const {
+      return cells[row][column] <= free_threshold;
+    }
+
+    /**
+     * @brief Adds a sonar reading to the grid.
+     *
+     * Several rays are traced across the beam, and the cells short of the range are
+     * cleared. If the reading was an echo within max_range, the cell at the range in the
+     * middle of the beam is filled. The sonar often gets no echo from a wall it meets at
+     * an angle, so a ping without one only clears out to no_echo_range; clearing the whole
+     * beam would wipe out walls already mapped and open up gaps that aren't there.
+     *
+     * @param x Pose x of the sensor in cm.
+     * @param y Pose y of the sensor in cm.
+     * @param bearing Direction the sensor faces in radians, counterclockwise from +y.
+     * @param range The range in cm.
+     * @param valid False if there was no echo, so the whole beam is clear.
+     */
+    void insert(float x, float y, float bearing, float range, bool valid) {
+      bool hit_found = valid && range < max_range;
+      float reach = valid ? min(range, max_range) : min(range, no_echo_range);
+      for (int ray = 0; ray < OCCUPANCY_GRID_BEAM_RAYS; ray++) {
+        float angle = bearing + beam_half_angle * (2.0 * ray / (OCCUPANCY_GRID_BEAM_RAYS - 1) - 1);
+        float dx = -sinf(angle);
+        float dy = cosf(angle);
+
+        int lastColumn = -1;
+        int lastRow = -1;
+        for (float travelled = 0; travelled < reach - cell_size / 2; travelled += cell_size / 2) {
+          int column, row;
+          if (!toCell(x + dx * travelled, y + dy * travelled, column, row)) break;
+          if (column == lastColumn && row == lastRow) continue;
+          lastColumn = column;
+          lastRow = row;
+          add(column, row, miss);
+        }
+
+      }
+
+      // The echo could have come from anywhere across the beam, but marking the whole arc
+      // would fill in gaps beside the wall, so only the middle of the beam is marked
+      int column, row;
+      if (hit_found && toCell(x - sinf(bearing) * reach, y + cosf(bearing) * reach, column, row)) {
+        add(column, row, hit);
+      }
+    }
+
+    /**
+     * @brief Prints the grid to the serial monitor, far end first.
+     *
+     * Occupied cells are '#', free cells '.', and unknown cells ' '.
+     */
+    void printout() {
+      for (int row = OCCUPANCY_GRID_ROWS - 1; row >= 0; row--) {
+        char line[OCCUPANCY_GRID_COLUMNS + 1];
+        for (int column = 0; column < OCCUPANCY_GRID_COLUMNS; column++) {
+          line[column] = isOccupied(column, row) ? '#' : isFree(column, row) ? '.' : ' ';
+        }
+        line[OCCUPANCY_GRID_COLUMNS] = '\0';
+        Serial.println(line);
+      }
+    }
+
+  private:
+    void add(int column, int row, int8_t amount) {
+      int value = cells[row][column] + amount;
+      cells[row][column] = constrain(value, -limit, limit);
+    }
+};
+
+/**
+ * @struct GapPlan
+ * @brief A gap the planner found in the wall ahead, or the side to look for one.
+ */
+struct GapPlan {
+  bool found = false;   ///< True if a gap wide enough was seen.
+  float wall_y = 0;     ///< Pose y of the near face of the wall in cm.
+  float gap_x = 0;      ///< Pose x of the middle of the gap in cm.
+  float gap_width = 0;  ///< Width of the gap in cm.
+  int side = 1;         ///< Side the gap is on, or to search first: -1 left, 1 right.
+};
+
+class GapPlanner {
+  public:
+    float lookahead = 150;    ///< Furthest a wall is looked for ahead of the robot in cm.
+    float search_width = 150; ///< Furthest a gap is looked for to either side in cm.
+    float min_gap_width = 35; ///< Narrowest gap the robot fits through in cm.
+    int wall_rows = 3;        ///< Rows from the near face of the wall checked for a gap.
+
+    /**
+     * @brief Looks for the wall ahead and the nearest gap in it.
+     *
+     * The wall is the nearest row ahead with an occupied cell within search_width. A gap
+     * is a run of columns with no occupied cells near the wall and at least one cell seen
+     * free, at least min_gap_width wide; the one whose middle is nearest the robot wins.
+     * If no gap has been seen, plan.side is the side on which less of the wall has been
+     * seen, where its end is likely nearer.
+     *
+     * @param grid The map.
+     * @param x Pose x of the robot in cm.
+     * @param y Pose y of the front of the robot in cm.
+     * @param plan Filled in with the result.
+     * @return True if a gap was found. plan.side is filled in whenever a wall was found.
+     */
+    bool plan(const OccupancyGrid& grid, float x, float y, GapPlan& plan) const {
+      plan.found = false;
+      int robotColumn, startRow;
+      if (!grid.toCell(x, y, robotColumn, startRow)) return false;
+
+      int reach = (int)(search_width / grid.cell_size);
+      int first = max(0, robotColumn - reach);
+      int last = min(OCCUPANCY_GRID_COLUMNS - 1, robotColumn + reach);
+      int endRow = min(OCCUPANCY_GRID_ROWS - 1, startRow + (int)(lookahead / grid.cell_size));
+      int wallRow = -1;
+      for (int row = max(startRow, 0); row <= endRow && wallRow < 0; row++) {
+        for (int column = first; column <= last; column++) {
+          if (grid.isOccupied(column, row)) {
+            wallRow = row;
+            break;
+          }
+        }
+      }
+      if (wallRow < 0) return false;
+      plan.wall_y = grid.rowY(wallRow) - grid.cell_size / 2;
+
+      int8_t state[OCCUPANCY_GRID_COLUMNS];
+      int seen[2] = {0, 0}; // Wall columns seen on each side, left then right
+      for (int column = first; column <= last; column++) {
+        state[column] = columnState(grid, column, wallRow);
+        if (state[column] > 0) seen[(column < robotColumn) ? 0 : 1]++;
+      }
+
+      // Pick the nearest run of open columns that is wide enough
+      float bestDistance = 1e9;
+      int column = first;
+      while (column <= last) {
+        if (state[column] >= 0) {
+          column++;
+          continue;
+        }
+        int runStart = column;
+        while (column <= last && state[column] < 0) column++;
+        int runEnd = column - 1;
+
+        float width = (runEnd - runStart + 1) * grid.cell_size;
+        float gapX = (grid.columnX(runStart) + grid.columnX(runEnd)) / 2;
+        float distance = fabs(gapX - x);
+        if (width >= min_gap_width && distance < bestDistance) {
+          bestDistance = distance;
+          plan.found = true;
+          plan.gap_x = gapX;
+          plan.gap_width = width;
+          plan.side = (gapX < x) ? -1 : 1;
+        }
+      }
+      if (!plan.found) plan.side = (seen[0] < seen[1]) ? -1 : 1;
+      return plan.found;
+    }
+
+  private:
+    /**
+     * @brief Classifies a column at the wall.
+     *
+     * @return 1 if any cell near the wall is occupied, -1 if none are and one was seen
+     * free, 0 if it hasn't been seen.
+     */
+    int columnState(const OccupancyGrid& grid, int column, int wallRow) const {
+      bool seenFree = false;
+      for (int row = wallRow; row < min(OCCUPANCY_GRID_ROWS, wallRow + wall_rows); row++) {
+        if (grid.isOccupied(column, row)) return 1;
+        if (grid.isFree(column, row)) seenFree = true;
+      }
+      return seenFree ? -1 : 0;
+    }
+};
+
+#endif // OCCUPANCY_GRID_H
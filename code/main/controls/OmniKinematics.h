@@ -0,0 +1,92 @@
+#ifndef OMNI_KINEMATICS_H
+#define OMNI_KINEMATICS_H
+// =====================
+
+/**
+ * @file OmniKinematics.h
+ * @brief Kinematics of the four omni wheel base.
+ *
+ * The robot has one omni wheel on each side. The left and right wheels roll along the
+ * robot's forward axis, and the top and bottom wheels roll along its sideways axis.
+ * The body frame has x to the right, y forward, and rotation counterclockwise positive
+ * when viewed from above. A wheel's velocity is positive when its motor is driven
+ * FORWARD:
+ *  - left and right FORWARD push the robot forward (+y),
+ *  - top FORWARD pushes the robot left (-x), bottom FORWARD pushes it right (+x).
+ * This matches Movement::move() and Movement::turn().
+ */
+
+#include <Arduino.h>
+
+/**
+ * @struct WheelVelocities
+ * @brief Signed value for each wheel, positive in the motor's FORWARD direction.
+ *
+ * Holds velocities in cm/s, or displacements in cm since the kinematics are linear.
+ */
+struct WheelVelocities {
+  float top;
+  float bottom;
+  float left;
+  float right;
+};
+
+/**
+ * @struct BodyTwist
+ * @brief Motion of the robot body in its own frame.
+ *
+ * Holds velocities (cm/s, rad/s) or, over a short interval, displacements (cm, rad).
+ */
+struct BodyTwist {
+  float vx;    ///< Sideways, positive to the right.
+  float vy;    ///< Forwards.
+  float omega; ///< Rotation, positive counterclockwise.
+};
+
+class OmniKinematics {
+  public:
+    float track_width; ///< Distance between the left and right wheels in cm.
+    float wheel_base;  ///< Distance between the top and bottom wheels in cm.
+
+    /**
+     * @brief Converts wheel velocities into the body twist.
+     *
+     * Translation comes from each wheel pair directly. Both pairs see the rotation, so
+     * omega is their least squares combination, weighted by each pair's lever arm.
+     *
+     * @param wheels The signed wheel velocities.
+     * @return The body twist.
+     */
+    BodyTwist forward(const WheelVelocities& wheels) const {
+      float half_track = track_width / 2;
+      float half_base = wheel_base / 2;
+
+      BodyTwist twist;
+      twist.vx = (wheels.bottom - wheels.top) / 2;
+      twist.vy = (wheels.left + wheels.right) / 2;
+      twist.omega = (
+        half_track * (wheels.right - wheels.left) + half_base * (wheels.top + wheels.bottom)
+        ) / (2 * (half_track * half_track + half_base * half_base));
+      return twist;
+    }
+
+    /**
+     * @brief Converts a body twist into the wheel velocities that produce it.
+     *
+     * @param twist The body twist.
+     * @return The signed wheel velocities.
+     */
+    WheelVelocities inverse(const BodyTwist& twist) const {
+      float half_track = track_width / 2;
+      float half_base = wheel_base / 2;
+
+      WheelVelocities wheels;
+      wheels.top = -twist.vx + twist.omega * half_base;
+      wheels.bottom = twist.vx + twist.omega * half_base;
+      wheels.left = twist.vy - twist.omega * half_track;
+      wheels.right = twist.vy + twist.omega * half_track;
+      return wheels;
+    }
+};
+
+#endif // OMNI_KINEMATICS_H
@@ -20,6 +20,7 @@
  * [2024 05 29] Added the Arduino.h header so VSCode can detect errors correctly
  * [2024 06 04] As part of a larger migration, was placed inside of the main folder
  * [2024 06 07] Removed an unneeded blank constructor, added comments
+ * [2026 10 18] Seeded the derivative with the first error, added output limits with anti-windup
  */
 
 #include <Arduino.h>
@@ -29,11 +30,14 @@ class PIDController {
     float previousError;          // Stores the previous PID output for integration calculation
     float integral;               // Stores the integral of the output over time
     unsigned long previousTime;   // Stores time from previous PID output for delta time
+    bool started;                 // False until the first compute() after initialize()
 
   public:
     float Kp;     // Proportional Gain
     float Ki;     // Integral Gain
     float Kd;     // Derivative Gain
+    float output_min = -INFINITY; // Lowest output, the integral stops growing past it
+    float output_max = INFINITY;  // Highest output, the integral stops growing past it
 
     void initialize() {
       /**
@@ -44,6 +48,21 @@ class PIDController {
       previousError = 0;
       integral = 0;
       previousTime = millis();
+      started = false;
+    }
+
+    void setOutputLimits(float min_output, float max_output) {
+      /**
+       * @brief Limits the control output.
+       * 
+       * While the output is held at a limit, the integral isn't added to in the direction
+       * that pushes further past it, so it doesn't wind up.
+       * 
+       * @param min_output The lowest output.
+       * @param max_output The highest output.
+       */
+      output_min = min_output;
+      output_max = max_output;
     }
 
     float compute(float error) {
@@ -51,7 +70,8 @@ class PIDController {
        * @brief Computes the control output based on the current error.
        * 
        * This method calculates the PID control output using the proportional, integral,
-       * and derivative gains and the current error value.
+       * and derivative gains and the current error value. The first call after
+       * initialize() has no previous error, so it takes no derivative.
        * 
        * @param error The current error value.
        * @return The computed control output.
@@ -59,10 +79,23 @@ class PIDController {
       unsigned long currentTime = millis();
       float deltaTime = (currentTime - previousTime) / 1000.0; // Convert to seconds
 
+      if (!started) {
+        previousError = error;
+        started = true;
+      }
+
       integral += error * deltaTime;
       float derivative = (deltaTime > 0) ? (error - previousError) / deltaTime : 0;
 
       float output = Kp * error + Ki * integral + Kd * derivative;
+      if (output > output_max || output < output_min) {
+        // Take back this step's integral if it pushed further into the limit
+        if ((output > output_max) == (Ki * error > 0)) {
+          integral -= error * deltaTime;
+          output -= Ki * error * deltaTime;
+        }
+        output = constrain(output, output_min, output_max);
+      }
 
       previousError = error;
       previousTime = currentTime;
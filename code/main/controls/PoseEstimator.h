@@ -0,0 +1,251 @@
+#ifndef POSE_ESTIMATOR_H
+#define POSE_ESTIMATOR_H
+// =====================
+
+/**
+ * @file PoseEstimator.h
+ * @brief Defines the PoseEstimator class for dead reckoning the robot's position.
+ *
+ * This file contains the definition of the PoseEstimator class, which integrates the
+ * signed distance driven by each wheel through the omni wheel kinematics into a pose
+ * (x, y, heading) at a fixed rate. The pose starts at the origin facing +y, in the same
+ * frame as the robot body at startup.
+ *
+ * Odometry drift grows with distance, so the estimator also carries the covariance of
+ * the pose, grown by each update in proportion to how far the wheels moved. Near a wall
+ * of known heading, correctRange() fuses a sonar range into the pose as an extended
+ * Kalman filter measurement. A range constrains the distance from the wall, and two
+ * sonars side by side on the same wall also constrain the heading.
+ */
+
+#include <Arduino.h>
+#include <string.h>
+#include "OmniKinematics.h"
+
+/**
+ * @struct WallLine
+ * @brief A straight wall in the pose frame.
+ *
+ * Points p on the wall satisfy n . p = offset, where n = (-sin heading, cos heading) is the
+ * direction the robot faces when it looks straight at the wall.
+ */
+struct WallLine {
+  float heading; ///< Robot heading that faces the wall squarely, in radians.
+  float offset;  ///< Distance of the wall from the origin along its normal in cm.
+};
+
+class PoseEstimator {
+  public:
+    float x = 0;                   ///< Position to the right of the start in cm.
+    float y = 0;                   ///< Position forward of the start in cm.
+    float heading = 0;             ///< Rotation from the start in radians, counterclockwise.
+    BodyTwist velocity = {0, 0, 0};///< Body velocity over the last update.
+    unsigned long period = 10;     ///< Minimum time between updates in ms.
+    unsigned long lastUpdateTime;  ///< Time of the last integration.
+    OmniKinematics kinematics;     ///< Wheel geometry.
+    WheelVelocities lastDistances; ///< Wheel odometers at the last integration.
+    float covariance[3][3] = {};   ///< Covariance of (x, y, heading) in cm and radians.
+    float translation_noise = 0.05;///< Position variance added per cm driven, in cm^2.
+    float rotation_noise = 0.01;   ///< Heading variance added per radian turned, in rad^2.
+    float drift_noise = 0.0001;    ///< Heading variance added per cm driven, in rad^2.
+    float gate = 9;                ///< Largest normalized squared innovation accepted (3 sigma).
+
+    /**
+     * @brief Resets the pose to the origin.
+     *
+     * @param distances The current wheel odometer readings in cm.
+     * @param now The current time in ms.
+     */
+    void initialize(const WheelVelocities& distances, unsigned long now) {
+      x = 0;
+      y = 0;
+      heading = 0;
+      velocity = {0, 0, 0};
+      memset(covariance, 0, sizeof(covariance));
+      lastDistances = distances;
+      lastUpdateTime = now;
+    }
+
+    /**
+     * @brief Checks whether the next update is due.
+     *
+     * @param now The current time in ms.
+     * @return True once period has passed since the last update.
+     */
+    bool due(unsigned long now) const {
+      return now - lastUpdateTime >= period;
+    }
+
+    /**
+     * @brief Integrates the wheel motion since the last update.
+     *
+     * The body displacement is rotated into the start frame at the midpoint heading of
+     * the interval.
+     *
+     * @param distances The current signed wheel odometer readings in cm.
+     * @param now The current time in ms.
+     */
+    void update(const WheelVelocities& distances, unsigned long now) {
+      WheelVelocities delta = {
+        distances.top - lastDistances.top,
+        distances.bottom - lastDistances.bottom,
+        distances.left - lastDistances.left,
+        distances.right - lastDistances.right,
+      };
+      BodyTwist motion = kinematics.forward(delta);
+
+      float mid_heading = heading + motion.omega / 2;
+      float c = cos(mid_heading);
+      float s = sin(mid_heading);
+      float dx = motion.vx * c - motion.vy * s;
+      float dy = motion.vx * s + motion.vy * c;
+      x += dx;
+      y += dy;
+      heading += motion.omega;
+      propagateCovariance(dx, dy, motion.omega);
+
+      float dt = (now - lastUpdateTime) / 1000.0;
+      if (dt > 0) {
+        velocity = {motion.vx / dt, motion.vy / dt, motion.omega / dt};
+      }
+      lastDistances = distances;
+      lastUpdateTime = now;
+    }
+
+    /**
+     * @brief Locates a wall from a range, taking the current pose as correct.
+     *
+     * @param mount_x Sensor position to the right of the robot's centre in cm.
+     * @param mount_y Sensor position forward of the robot's centre in cm.
+     * @param range The range to the wall in cm, along the robot's forward axis.
+     * @param wall_heading The heading that faces the wall squarely, in radians.
+     * @return The wall.
+     */
+    WallLine wallFromRange(float mount_x, float mount_y, float range, float wall_heading) const {
+      float angle = heading - wall_heading;
+      float sensor_x = x + mount_x * cos(heading) - mount_y * sin(heading);
+      float sensor_y = y + mount_x * sin(heading) + mount_y * cos(heading);
+      float along_normal = -sin(wall_heading) * sensor_x + cos(wall_heading) * sensor_y;
+      return {wall_heading, along_normal + range * cosf(angle)};
+    }
+
+    /**
+     * @brief Predicts the range a forward facing sensor would measure to a wall.
+     *
+     * @param wall The wall.
+     * @param mount_x Sensor position to the right of the robot's centre in cm.
+     * @param mount_y Sensor position forward of the robot's centre in cm.
+     * @return The range in cm.
+     */
+    float predictRange(const WallLine& wall, float mount_x, float mount_y) const {
+      float angle = heading - wall.heading;
+      float along_normal = -sin(wall.heading) * x + cos(wall.heading) * y;
+      return (wall.offset - along_normal - mount_x * sin(angle) - mount_y * cos(angle)) / cos(angle);
+    }
+
+    /**
+     * @brief Corrects the pose with a range to a known wall.
+     *
+     * Readings whose innovation falls outside the gate, such as echoes from something
+     * other than the wall, are ignored.
+     *
+     * @param wall The wall the sensor is looking at.
+     * @param mount_x Sensor position to the right of the robot's centre in cm.
+     * @param mount_y Sensor position forward of the robot's centre in cm.
+     * @param range The measured range in cm.
+     * @param noise Standard deviation of the range in cm.
+     * @return True if the reading was used.
+     */
+    bool correctRange(const WallLine& wall, float mount_x, float mount_y, float range, float noise) {
+      float angle = heading - wall.heading;
+      if (fabs(angle) > 0.5) return false; // Too oblique for the echo to come from the wall
+      float predicted = predictRange(wall, mount_x, mount_y);
+      float innovation = range - predicted;
+
+      // Jacobian of the predicted range with respect to (x, y, heading)
+      float h[3] = {
+        sinf(wall.heading) / cosf(angle),
+        -cosf(wall.heading) / cosf(angle),
+        -mount_x + (mount_y + predicted) * tanf(angle),
+      };
+
+      float ph[3];
+      for (int i = 0; i < 3; i++) {
+        ph[i] = covariance[i][0] * h[0] + covariance[i][1] * h[1] + covariance[i][2] * h[2];
+      }
+      float innovation_variance = h[0] * ph[0] + h[1] * ph[1] + h[2] * ph[2] + noise * noise;
+      if (innovation * innovation / innovation_variance > gate) return false;
+
+      float gain[3];
+      for (int i = 0; i < 3; i++) {
+        gain[i] = ph[i] / innovation_variance;
+      }
+      x += gain[0] * innovation;
+      y += gain[1] * innovation;
+      heading += gain[2] * innovation;
+
+      // P = P - K (H P), with H P = ph transposed since P is symmetric
+      for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+          covariance[i][j] -= gain[i] * ph[j];
+        }
+      }
+      return true;
+    }
+
+    /**
+     * @brief Prints the pose to the serial monitor.
+     */
+    void printout() {
+      Serial.print("x: ");
+      Serial.print(x);
+      Serial.print(" cm | y: ");
+      Serial.print(y);
+      Serial.print(" cm | heading: ");
+      Serial.print(heading * RAD_TO_DEG);
+      Serial.print(" deg | sigma x: ");
+      Serial.print(sqrtf(covariance[0][0]));
+      Serial.print(" cm | sigma y: ");
+      Serial.print(sqrtf(covariance[1][1]));
+      Serial.print(" cm | sigma heading: ");
+      Serial.print(sqrtf(covariance[2][2]) * RAD_TO_DEG);
+      Serial.println(" deg");
+    }
+
+  private:
+    /**
+     * @brief Grows the covariance over one integration step.
+     *
+     * @param dx Displacement to the right in the pose frame in cm.
+     * @param dy Displacement forward in the pose frame in cm.
+     * @param dheading Change in heading in radians.
+     */
+    void propagateCovariance(float dx, float dy, float dheading) {
+      // F = I + J, where the only non-zero entries of J are how a heading error swings the
+      // displacement: J[0][2] = -dy, J[1][2] = dx
+      float j0 = -dy;
+      float j1 = dx;
+      float p[3][3];
+      memcpy(p, covariance, sizeof(p));
+      for (int i = 0; i < 3; i++) {
+        // Rows: P + J P
+        p[0][i] += j0 * covariance[2][i];
+        p[1][i] += j1 * covariance[2][i];
+      }
+      float q[3][3];
+      memcpy(q, p, sizeof(q));
+      for (int i = 0; i < 3; i++) {
+        // Columns: (P + J P) + (P + J P) J^T
+        q[i][0] += p[i][2] * j0;
+        q[i][1] += p[i][2] * j1;
+      }
+
+      float distance = sqrtf(dx * dx + dy * dy);
+      q[0][0] += translation_noise * distance;
+      q[1][1] += translation_noise * distance;
+      q[2][2] += rotation_noise * fabs(dheading) + drift_noise * distance;
+      memcpy(covariance, q, sizeof(covariance));
+    }
+};
+
+#endif // POSE_ESTIMATOR_H
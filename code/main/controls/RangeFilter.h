@@ -0,0 +1,164 @@
+#ifndef RANGE_FILTER_H
+#define RANGE_FILTER_H
+// =====================
+
+/**
+ * @file RangeFilter.h
+ * @brief Defines the RangeFilter class for rejecting spurious sonar echoes.
+ *
+ * This file contains the definition of the RangeFilter class, which runs each new sonar
+ * range through a short median and then a constant velocity Kalman filter on range and
+ * range rate. The median removes single sample spikes from multipath echoes. The Kalman
+ * filter's innovation (how far the median lands from the predicted range, scaled by its
+ * expected spread) gates what is left: readings outside the gate are held back and
+ * flagged invalid, unless two in a row agree with each other, in which case the wall
+ * really did move (an obstacle edge passing the sensor) and the filter jumps to the new
+ * range. Decisions that have to catch an edge as soon as it passes can use median_range,
+ * which is a reading behind the raw range rather than several.
+ */
+
+#include <Arduino.h>
+
+#define RANGE_FILTER_WINDOW_MAX 5 ///< Longest median window.
+
+class RangeFilter {
+  public:
+    int median_window = 3;        ///< Readings in the median, odd and at most RANGE_FILTER_WINDOW_MAX.
+    float measurement_noise = 1;  ///< Standard deviation of a sonar reading in cm.
+    float acceleration_noise = 200; ///< Standard deviation of unmodelled acceleration in cm/sec^2.
+    float gate = 9;               ///< Largest normalized squared innovation accepted (3 sigma).
+    int max_rejections = 2;       ///< Agreeing rejected readings in a row before the filter resets to them.
+    float step_tolerance = 5;     ///< Rejected readings this close in cm agree on a new range.
+
+    float range = 0;              ///< Filtered range in cm.
+    float rate = 0;               ///< Filtered range rate in cm/sec, negative when closing.
+    bool valid = false;           ///< False if the last reading was rejected by the gate.
+    float innovation = 0;         ///< Last median range minus the predicted range in cm.
+    float median_range = 0;       ///< Median of the latest readings in cm, before the gate.
+    int rejections = 0;           ///< Readings rejected in a row.
+
+    /**
+     * @brief Clears the filter so the next reading starts it again.
+     */
+    void initialize() {
+      samples = 0;
+      next = 0;
+      rejections = 0;
+      valid = false;
+      initialized = false;
+    }
+
+    /**
+     * @brief Filters a new range reading.
+     *
+     * @param measured The raw range in cm.
+     * @param now The time of the reading in ms. Readings with the same time as the last
+     * one are treated as repeats and ignored.
+     * @return The filtered range in cm.
+     */
+    float update(float measured, unsigned long now) {
+      if (initialized && now == lastTime) return range;
+
+      // median_window is public, so keep it inside the fixed size window here
+      int size = constrain(median_window, 1, RANGE_FILTER_WINDOW_MAX);
+      if (next >= size) next = 0;
+      window[next] = measured;
+      next = (next + 1) % size;
+      if (samples < size) samples++;
+      else samples = size;
+      float z = median();
+      median_range = z;
+
+      if (!initialized) {
+        reset(z, now);
+        return range;
+      }
+
+      // Predict
+      float dt = (now - lastTime) / 1000.0;
+      lastTime = now;
+      range += rate * dt;
+      float q = acceleration_noise * acceleration_noise;
+      float dt2 = dt * dt;
+      p00 += dt * (2 * p01 + dt * p11) + q * dt2 * dt2 / 4;
+      p01 += dt * p11 + q * dt2 * dt / 2;
+      p11 += q * dt2;
+
+      // Gate on the normalized innovation
+      innovation = z - range;
+      float s = p00 + measurement_noise * measurement_noise;
+      valid = innovation * innovation / s <= gate;
+      if (!valid) {
+        if (rejections > 0 && fabs(z - rejectedRange) > step_tolerance) rejections = 0;
+        rejectedRange = z;
+        if (++rejections >= max_rejections) reset(z, now);
+        return range;
+      }
+      rejections = 0;
+
+      // Correct
+      float k0 = p00 / s;
+      float k1 = p01 / s;
+      range += k0 * innovation;
+      rate += k1 * innovation;
+      p11 -= k1 * p01;
+      p01 -= k0 * p01;
+      p00 -= k0 * p00;
+      return range;
+    }
+
+    /**
+     * @brief Prints the filter state to the serial monitor.
+     */
+    void printout() {
+      Serial.print("Range: ");
+      Serial.print(range);
+      Serial.print(" cm | Rate: ");
+      Serial.print(rate);
+      Serial.print(" cm/s | Innovation: ");
+      Serial.print(innovation);
+      Serial.println(valid ? " cm" : " cm (rejected)");
+    }
+
+  private:
+    float window[RANGE_FILTER_WINDOW_MAX]; ///< Latest raw readings, oldest overwritten first.
+    int samples = 0;                       ///< Readings in the window.
+    int next = 0;                          ///< Window slot for the next reading.
+    float p00 = 0, p01 = 0, p11 = 0;       ///< Covariance of range and rate.
+    float rejectedRange = 0;               ///< Median of the last rejected reading.
+    unsigned long lastTime = 0;            ///< Time of the last reading in ms.
+    bool initialized = false;              ///< False until the first reading.
+
+    /**
+     * @brief Starts the filter at a range, at rest, with the rate unknown.
+     */
+    void reset(float z, unsigned long now) {
+      range = z;
+      rate = 0;
+      innovation = 0;
+      p00 = measurement_noise * measurement_noise;
+      p01 = 0;
+      p11 = 100 * 100;
+      lastTime = now;
+      rejections = 0;
+      valid = true;
+      initialized = true;
+    }
+
+    /**
+     * @brief Median of the readings in the window.
+     */
+    float median() const {
+      float sorted[RANGE_FILTER_WINDOW_MAX];
+      for (int i = 0; i < samples; i++) {
+        int j = i;
+        for (; j > 0 && sorted[j - 1] > window[i]; j--) {
+          sorted[j] = sorted[j - 1];
+        }
+        sorted[j] = window[i];
+      }
+      return sorted[samples / 2];
+    }
+};
+
+#endif // RANGE_FILTER_H
@@ -0,0 +1,88 @@
+#ifndef SLEW_LIMITER_H
+#define SLEW_LIMITER_H
+// =====================
+
+/**
+ * @file SlewLimiter.h
+ * @brief Defines the SlewLimiter class for limiting how quickly a motor command changes.
+ *
+ * This file contains the definition of the SlewLimiter class, which moves a signed PWM
+ * percentage towards its target with a limited rate of change (acceleration) and a
+ * limited change in that rate (jerk). Stepping a wheel from rest to full PWM, or from
+ * FORWARD to BACKWARD, makes the wheels slip and the chassis pitch on its suspension,
+ * so the limits are set separately for speeding up, slowing down, and reversing.
+ */
+
+#include <Arduino.h>
+
+/**
+ * @struct SlewLimits
+ * @brief Rate and jerk limits for one kind of transition.
+ */
+struct SlewLimits {
+  float rate; ///< Largest change in PWM percent per second.
+  float jerk; ///< Largest change in rate per second.
+};
+
+class SlewLimiter {
+  public:
+    SlewLimits accelerate = {400, 4000}; ///< Speeding up in the same direction, or from OFF.
+    SlewLimits decelerate = {600, 6000}; ///< Slowing down in the same direction, or to OFF.
+    SlewLimits reverse = {250, 2500};    ///< Going from FORWARD to BACKWARD or back.
+
+    float output = 0;                    ///< Signed PWM percentage being applied.
+    float rate = 0;                      ///< Current rate of change in percent per second.
+
+    /**
+     * @brief Jumps to a value with no rate of change.
+     *
+     * @param value The signed PWM percentage to start from.
+     */
+    void initialize(float value) {
+      output = value;
+      rate = 0;
+    }
+
+    /**
+     * @brief Moves the output one step towards a target.
+     *
+     * The rate is limited so it can still fall to zero, within the jerk limit, by the
+     * time the output reaches the target, so the output doesn't overshoot.
+     *
+     * @param target The signed PWM percentage requested.
+     * @param dt Seconds since the last call.
+     * @return The signed PWM percentage to apply.
+     */
+    float update(float target, float dt) {
+      if (dt <= 0) return output;
+
+      const SlewLimits& limits = limitsFor(target);
+      float error = target - output;
+      float direction = (error >= 0) ? 1 : -1;
+      float wanted = direction * min(limits.rate, sqrtf(2 * limits.jerk * fabs(error)));
+
+      float max_change = limits.jerk * dt;
+      rate += constrain(wanted - rate, -max_change, max_change);
+      output += rate * dt;
+
+      // Land on the target rather than stepping past it
+      if ((target - output) * direction <= 0) {
+        output = target;
+        rate = 0;
+      }
+      return output;
+    }
+
+  private:
+    /**
+     * @brief Picks the limits for the transition from the output to a target.
+     */
+    const SlewLimits& limitsFor(float target) const {
+      if ((output > 0 && target < 0) || (output < 0 && target > 0)) {
+        return reverse;
+      }
+      return (fabs(target) > fabs(output)) ? accelerate : decelerate;
+    }
+};
+
+#endif // SLEW_LIMITER_H
@@ -0,0 +1,61 @@
+#ifndef VELOCITY_CONTROLLER_H
+#define VELOCITY_CONTROLLER_H
+// =====================
+
+/**
+ * @file VelocityController.h
+ * @brief Defines the VelocityController class for closed-loop wheel speed control.
+ *
+ * This file contains the definition of the VelocityController class, which adds a PI
+ * correction on top of a feedforward PWM taken from the motor's calibration table. The
+ * feedforward does most of the work, so the loop only has to cancel what the table gets
+ * wrong, such as a heavier load or a different floor.
+ */
+
+#include <Arduino.h>
+
+class VelocityController {
+  public:
+    float Kp = 1.5;              ///< PWM percent per cm/sec of error.
+    float Ki = 6;                ///< PWM percent per cm of accumulated error.
+    float integral_limit = 30;   ///< Largest PWM percent the integral term can add.
+
+    float integral = 0;          ///< Integral term in PWM percent.
+    float previousTarget = 0;    ///< Target of the previous call.
+
+    /**
+     * @brief Resets the integral term.
+     */
+    void initialize() {
+      integral = 0;
+      previousTarget = 0;
+    }
+
+    /**
+     * @brief Computes the signed PWM percentage for a wheel.
+     *
+     * The integral resets whenever the target stops or reverses, so correction built up
+     * in one direction isn't carried into the other.
+     *
+     * @param target The signed target velocity in cm/sec.
+     * @param measured The signed measured velocity in cm/sec.
+     * @param feedforward The unsigned PWM percentage the calibration gives for |target|.
+     * @param dt Seconds since the last call.
+     * @return The signed PWM percentage, limited to -100 to 100.
+     */
+    float compute(float target, float measured, float feedforward, float dt) {
+      if (target == 0 || (target > 0) != (previousTarget > 0)) {
+        integral = 0;
+      }
+      previousTarget = target;
+      if (target == 0) return 0;
+
+      float error = target - measured;
+      integral = constrain(integral + Ki * error * dt, -integral_limit, integral_limit);
+
+      float direction = (target > 0) ? 1 : -1;
+      return constrain(direction * feedforward + Kp * error + integral, -100.0f, 100.0f);
+    }
+};
+
+#endif // VELOCITY_CONTROLLER_H
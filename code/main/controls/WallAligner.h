@@ -0,0 +1,70 @@
+#ifndef WALL_ALIGNER_H
+#define WALL_ALIGNER_H
+// =====================
+
+/**
+ * @file WallAligner.h
+ * @brief Defines the WallAligner class for squaring the robot up to a wall with the sonars.
+ *
+ * This file contains the definition of the WallAligner class, which turns the left and
+ * right sonar ranges into the angle between the robot and the wall in front of it,
+ * atan2(left - right, spacing), and commands a yaw rate proportional to it. Because the
+ * angle is measured rather than just its sign, the turn slows down as it closes in
+ * instead of overshooting at a fixed speed, and it can be added to a translation so the
+ * robot squares up while it crab walks.
+ */
+
+#include <Arduino.h>
+
+class WallAligner {
+  public:
+    float spacing = 1;        ///< Distance between the left and right sonars in cm.
+    float gain = 3;           ///< Yaw rate per radian of wall angle, in 1/sec.
+    float max_rate = 1.5;     ///< Fastest commanded yaw rate in rad/sec.
+    float min_rate = 0.15;    ///< Slowest commanded yaw rate outside the tolerance, so the wheels don't stall.
+    float tolerance = 0.04;   ///< Wall angle counted as aligned, in radians.
+
+    float angle = 0;          ///< Last measured wall angle in radians, positive when the left side is farther.
+    float rate = 0;           ///< Last commanded yaw rate in rad/sec, counterclockwise positive.
+
+    /**
+     * @brief Sets the sonar geometry and clears the last measurement.
+     *
+     * @param sonar_spacing Distance between the left and right sonars in cm.
+     */
+    void initialize(float sonar_spacing) {
+      spacing = sonar_spacing;
+      angle = 0;
+      rate = 0;
+    }
+
+    /**
+     * @brief Measures the wall angle and works out the yaw rate that squares up to it.
+     *
+     * A farther left range means the robot is turned counterclockwise from the wall's
+     * normal, so it turns clockwise by the angle.
+     *
+     * @param left The left sonar range in cm.
+     * @param right The right sonar range in cm.
+     * @return The yaw rate to command in rad/sec, 0 once aligned.
+     */
+    float update(float left, float right) {
+      angle = atan2(left - right, spacing);
+      if (aligned()) {
+        rate = 0;
+      } else {
+        float magnitude = constrain(gain * fabs(angle), min_rate, max_rate);
+        rate = (angle > 0) ? -magnitude : magnitude;
+      }
+      return rate;
+    }
+
+    /**
+     * @brief Checks whether the last measured angle is within the tolerance.
+     */
+    bool aligned() const {
+      return fabs(angle) <= tolerance;
+    }
+};
+
+#endif // WALL_ALIGNER_H
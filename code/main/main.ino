@@ -4,6 +4,7 @@
 #include "ObstacleAvoidance.h"
 #include "PickupPlace.h"
 #include "LineFollowing.h"
+#include "MotorSelfCalibration.h"
 
 /**
  * @file main.cpp
@@ -29,7 +30,10 @@ void setup() {
   Serial.println("| ===== Program Start ===== |");
 
   // Calls to initialization functions from included headers
+  // initBattery(); ///< Uncomment once the battery divider is wired, with its pin set in initBattery()
   initMotors(); 
+  motorSelfCalibration.load(); // Replaces the hardcoded tables once the robot has measured its own
+  bot.initialize();
   initButtons();
   initUltrasonicSensors();
   initServos();
@@ -37,6 +41,9 @@ void setup() {
   initPID();
   initColorSensors();
   initColorCalibrations();
+  // motorSelfCalibration.run(); ///< Uncomment to re-measure the motor tables facing a wall
+  // dspBenchmark(); ///< Uncomment to time the DSP kernels against their scalar versions
+  // velocityLoopCheck(topMotor); ///< Uncomment to run a wheel's velocity loop against a simulated load
 
   Serial.println("| ==== Setup Complete ==== |"); 
 }
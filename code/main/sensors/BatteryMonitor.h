@@ -0,0 +1,103 @@
+/**
+ * @file BatteryMonitor.h
+ * @brief Defines the BatteryMonitor class for sampling the motor supply voltage.
+ *
+ * This file contains the definition of the BatteryMonitor class, which reads the motor
+ * battery through a resistor divider on an ADC pin, low pass filters it, and turns it
+ * into a compensation factor for the motor PWM. The motor calibration tables were
+ * measured at one supply voltage, so scaling the PWM by calibration voltage / battery
+ * voltage keeps the average voltage across the motor, and so its speed, on the table.
+ */
+
+#ifndef BATTERY_MONITOR_H
+#define BATTERY_MONITOR_H
+
+#include <Arduino.h>
+
+class BatteryMonitor {
+  public:
+    int pin = -1;                     ///< ADC pin on the divider, -1 if no divider is fitted.
+    float divider_ratio = 4.0;        ///< Battery voltage / pin voltage.
+    float reference_voltage = 3.3;    ///< ADC full scale voltage.
+    int adc_resolution = 10;          ///< ADC bits.
+    float nominal_voltage = 12.0;     ///< Supply voltage the motor tables were measured at.
+    float min_compensation = 0.8;     ///< Smallest PWM scale applied.
+    float max_compensation = 1.5;     ///< Largest PWM scale applied.
+    float filter_weight = 0.1;        ///< Weight of each new sample in the low pass filter.
+    unsigned long sample_period = 50; ///< Time between samples in ms.
+    float log_step = 0.02;            ///< Change in compensation that gets logged.
+    bool debug = false;               ///< Log the compensation factor as it changes.
+
+    float voltage;                    ///< Filtered battery voltage.
+    float compensation;               ///< nominal_voltage / voltage, limited to the bounds.
+    float loggedCompensation;         ///< Compensation at the last log line.
+    unsigned long lastSampleTime;     ///< Time of the last sample.
+
+    /**
+     * @brief Sets up the ADC pin and takes the first reading.
+     */
+    void initialize() {
+      voltage = nominal_voltage;
+      compensation = 1;
+      loggedCompensation = 1;
+      lastSampleTime = millis();
+      if (pin < 0) return;
+
+      pinMode(pin, INPUT);
+      voltage = readVoltage();
+      compensation = getCompensation(nominal_voltage);
+    }
+
+    /**
+     * @brief Reads the battery voltage once without filtering.
+     *
+     * @return The battery voltage.
+     */
+    float readVoltage() {
+      float counts = analogRead(pin);
+      return counts * reference_voltage / ((1 << adc_resolution) - 1) * divider_ratio;
+    }
+
+    /**
+     * @brief Gets the PWM scale that makes this battery match a table's voltage.
+     *
+     * @param calibration_voltage The voltage the table was measured at.
+     * @return The factor to multiply PWM by.
+     */
+    float getCompensation(float calibration_voltage) {
+      if (voltage <= 0) return 1;
+      return constrain(calibration_voltage / voltage, min_compensation, max_compensation);
+    }
+
+    /**
+     * @brief Samples and filters the voltage once sample_period has passed.
+     *
+     * @param now The current time in ms.
+     * @return True if a new sample was taken.
+     */
+    bool update(unsigned long now) {
+      if (pin < 0 || now - lastSampleTime < sample_period) return false;
+      lastSampleTime = now;
+
+      voltage += filter_weight * (readVoltage() - voltage);
+      compensation = getCompensation(nominal_voltage);
+
+      if (debug && fabs(compensation - loggedCompensation) >= log_step) {
+        printout();
+        loggedCompensation = compensation;
+      }
+      return true;
+    }
+
+    /**
+     * @brief Prints the voltage and compensation factor to the serial monitor.
+     */
+    void printout() {
+      Serial.print("Battery: ");
+      Serial.print(voltage);
+      Serial.print(" V | Compensation: ");
+      Serial.println(compensation, 3);
+    }
+};
+
+#endif // BATTERY_MONITOR_H
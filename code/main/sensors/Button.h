@@ -3,7 +3,9 @@
  * @brief Defines the Button class for handling button input on an Arduino.
  * 
  * This file contains the definition of the Button class, which is used to manage
- * the state and initialization of a button connected to an Arduino pin.
+ * the state and initialization of a button connected to an Arduino pin. A debounced
+ * edge interrupt captures the exact time of a press and, optionally, the commanded
+ * angle of a servo at that moment.
  * 
  * Created by: Max Westerman
  */
@@ -13,10 +15,27 @@
 
 #include <Arduino.h>
 
+class Button;
+
+/**
+ * @brief Returns the button whose edge interrupt is attached.
+ */
+Button*& buttonInterruptTarget() {
+  static Button* target = nullptr;
+  return target;
+}
+
 class Button {
   public:
     int pin;     // Pin number to which the button is connected
     bool state;  // Current state of the button (true for pressed, false for not pressed)
+    unsigned long debounce_time = 5000; // Edges closer than this to the last one are bounce (us)
+
+    volatile bool contact = false;               // Set by the ISR on the first press after arming
+    volatile unsigned long contactTime = 0;      // micros() at the press
+    volatile float contactAngle = 0;             // Commanded servo angle at the press
+    volatile unsigned long lastEdgeTime = 0;     // micros() of the last accepted edge
+    const volatile float* angleSource = nullptr; // Angle sampled at the press, if any
 
     /**
      * @brief Reads and returns the current state of the button.
@@ -35,10 +54,61 @@ class Button {
     /**
      * @brief Initializes the button pin.
      * 
-     * This function sets the button pin mode to INPUT_PULLDOWN.
+     * This function sets the button pin mode to INPUT_PULLDOWN and attaches the press
+     * interrupt.
      */
     void initialize() {
       pinMode(pin, INPUT_PULLDOWN);
+      buttonInterruptTarget() = this;
+      attachInterrupt(digitalPinToInterrupt(pin), isr, RISING);
+    }
+
+    /**
+     * @brief Clears the last press and starts watching for the next one.
+     * 
+     * If the button is already held down no rising edge will come, so the press is
+     * captured straight away with the angle at arming.
+     * 
+     * @param angle The servo angle to sample when the press happens, or nullptr.
+     */
+    void armContact(const volatile float* angle) {
+      noInterrupts();
+      angleSource = angle;
+      contact = false;
+      if (digitalRead(pin) == HIGH) {
+        contactTime = micros();
+        contactAngle = (angleSource != nullptr) ? *angleSource : 0;
+        contact = true;
+      }
+      interrupts();
+    }
+
+    /**
+     * @brief Checks whether the button was pressed since armContact().
+     * 
+     * @return True once a press has been captured.
+     */
+    bool contacted() const {
+      return contact;
+    }
+
+    /**
+     * @brief Records the first debounced press. Runs in interrupt context.
+     */
+    void handleEdge() {
+      unsigned long now = micros();
+      if (now - lastEdgeTime < debounce_time) return;
+      lastEdgeTime = now;
+      if (contact) return;
+
+      contactTime = now;
+      contactAngle = (angleSource != nullptr) ? *angleSource : 0;
+      contact = true;
+    }
+
+  private:
+    static void isr() {
+      buttonInterruptTarget()->handleEdge();
     }
 };
 
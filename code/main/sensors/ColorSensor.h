@@ -16,6 +16,8 @@
 #include <deque>
 #include <map>
 #include <vector> 
+#include "../controls/DSPKernels.h"
+#include "FastPin.h"
 
 enum Color {
   RED,
@@ -37,6 +39,8 @@ class ColorSensor {
     int output_frequency_0_pin, output_frequency_1_pin;
     int color_selector_2_pin, color_selector_3_pin;
     int out_pin;
+    OutputPin frequency_0_output, frequency_1_output; // Direct register access to S0/S1
+    OutputPin selector_2_output, selector_3_output;   // Direct register access to S2/S3
 
     Color color;
     int red, green, blue;
@@ -50,19 +54,9 @@ class ColorSensor {
     const char* calibration_name;
 
     std::vector<CalibrationPoint> calibration;
+    std::vector<int16_t> calibration_table; // Packed copy of calibration for dspNearestColor
     std::deque<Color> color_history;
 
-    /**
-     * @brief Calculates the Euclidean distance between two colors.
-     * 
-     * @param color1 The first color's RGB values.
-     * @param color2 The second color's RGB values.
-     * @return The Euclidean distance between the two colors.
-     */
-    float calculateEuclideanDistance(const int color1[3], const int color2[3]) {
-      return sqrt(pow(color2[0] - color1[0], 2) + pow(color2[1] - color1[1], 2) + pow(color2[2] - color1[2], 2));
-    }
-
     /**
      * @brief Adds a calibration point for a specific color.
      * 
@@ -74,6 +68,10 @@ class ColorSensor {
     void addCalibrationPoint(Color color, int red, int green, int blue) {
       CalibrationPoint newPoint = {color, {red, green, blue}};
       calibration.push_back(newPoint);
+      calibration_table.push_back(constrain(red, 0, DSP_COLOR_MAX));
+      calibration_table.push_back(constrain(green, 0, DSP_COLOR_MAX));
+      calibration_table.push_back(constrain(blue, 0, DSP_COLOR_MAX));
+      calibration_table.push_back(0);
     }
 
     /**
@@ -82,20 +80,20 @@ class ColorSensor {
     void setFrequencyScaling() {
       switch (frequency) {
         case 0:
-          digitalWrite(output_frequency_0_pin, LOW);
-          digitalWrite(output_frequency_1_pin, LOW);
+          frequency_0_output.low();
+          frequency_1_output.low();
           break;
         case 2:
-          digitalWrite(output_frequency_0_pin, LOW);
-          digitalWrite(output_frequency_1_pin, HIGH);
+          frequency_0_output.low();
+          frequency_1_output.high();
           break;
         case 20:
-          digitalWrite(output_frequency_0_pin, HIGH);
-          digitalWrite(output_frequency_1_pin, LOW);
+          frequency_0_output.high();
+          frequency_1_output.low();
           break;
         case 100:
-          digitalWrite(output_frequency_0_pin, HIGH);
-          digitalWrite(output_frequency_1_pin, HIGH);
+          frequency_0_output.high();
+          frequency_1_output.high();
           break;
       }
     }
@@ -108,8 +106,8 @@ class ColorSensor {
      * @return The color frequency.
      */
     int readColorFrequency(int s2_value, int s3_value) {
-      digitalWrite(color_selector_2_pin, s2_value);
-      digitalWrite(color_selector_3_pin, s3_value);
+      selector_2_output.write(s2_value);
+      selector_3_output.write(s3_value);
       return pulseIn(out_pin, LOW);
     }
 
@@ -129,20 +127,23 @@ class ColorSensor {
      */
     Color getColor() {
       readRGB();
-      int sensor_rgb_readings[3] = {red, green, blue};
-      float minDistance = 100000;
+      int16_t sensor_rgb_readings[3] = {
+        (int16_t)constrain(red, 0, DSP_COLOR_MAX),
+        (int16_t)constrain(green, 0, DSP_COLOR_MAX),
+        (int16_t)constrain(blue, 0, DSP_COLOR_MAX),
+      };
       color = UNKNOWN;
       Color return_color = UNKNOWN;
 
-      for (const auto& cal : calibration) {
-        float distance = calculateEuclideanDistance(sensor_rgb_readings, cal.values);
-        if (distance < minDistance) {
-          minDistance = distance;
-          color = cal.color;
-        }
+      // Compare squared distances so no square root is needed per calibration point
+      uint32_t min_distance_sq;
+      int nearest = dspNearestColor(calibration_table.data(), calibration.size(),
+                                    sensor_rgb_readings, min_distance_sq);
+      if (nearest >= 0) {
+        color = calibration[nearest].color;
       }
 
-      if (minDistance < distance_trigger){
+      if (nearest >= 0 && min_distance_sq < distance_trigger * distance_trigger){
         color_history.push_back(color);
         if (color_history.size() > static_cast<unsigned int>(moving_average_window)) {
           color_history.pop_front();
@@ -215,10 +216,10 @@ class ColorSensor {
       green = 0;
       blue = 0;
       color = UNKNOWN;
-      pinMode(output_frequency_0_pin, OUTPUT);
-      pinMode(output_frequency_1_pin, OUTPUT);
-      pinMode(color_selector_2_pin, OUTPUT);
-      pinMode(color_selector_3_pin, OUTPUT);
+      frequency_0_output.attach(output_frequency_0_pin);
+      frequency_1_output.attach(output_frequency_1_pin);
+      selector_2_output.attach(color_selector_2_pin);
+      selector_3_output.attach(color_selector_3_pin);
       pinMode(out_pin, INPUT);
       setFrequencyScaling();
     }
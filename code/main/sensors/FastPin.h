@@ -0,0 +1,127 @@
+/**
+ * @file FastPin.h
+ * @brief Defines OutputPin for writing digital outputs without digitalWrite().
+ *
+ * This file contains OutputPin, which drives a digital output directly through the GPIO
+ * set/clear registers of the Teensy 4.1. It looks the registers up once in attach(), as
+ * the drivers' pin numbers are assigned in Initialization.h rather than known at compile
+ * time.
+ * Other Arduino boards fall back to digitalWrite(). Host builds (no ARDUINO define) record
+ * every write in fastPinMock() so driver logic can be checked without hardware.
+ */
+
+#ifndef FAST_PIN_H
+#define FAST_PIN_H
+
+#include <Arduino.h>
+
+#if defined(__IMXRT1062__)
+#define FAST_PIN_REGISTERS
+#elif !defined(ARDUINO)
+#define FAST_PIN_MOCK
+#endif
+
+#if defined(FAST_PIN_MOCK)
+#define FAST_PIN_MOCK_PINS 64 ///< Number of pins tracked by the host mock.
+
+/**
+ * @struct FastPinMock
+ * @brief Host stand-in for the GPIO registers.
+ */
+struct FastPinMock {
+  int level[FAST_PIN_MOCK_PINS];      ///< Last level written to each pin
+  unsigned long writes;               ///< Total writes across all pins
+  int lastPin;                        ///< Pin of the most recent write
+};
+
+/**
+ * @brief Returns the single host mock shared by every OutputPin.
+ */
+FastPinMock& fastPinMock() {
+  static FastPinMock mock = {};
+  return mock;
+}
+
+/**
+ * @brief Records a write in the host mock.
+ */
+void fastPinMockWrite(int pin, bool value) {
+  FastPinMock& mock = fastPinMock();
+  if (pin >= 0 && pin < FAST_PIN_MOCK_PINS) {
+    mock.level[pin] = value;
+  }
+  mock.lastPin = pin;
+  mock.writes++;
+}
+#endif
+
+/**
+ * @class OutputPin
+ * @brief A digital output whose set/clear registers are resolved once at attach time.
+ */
+class OutputPin {
+  public:
+    int pin = -1; ///< Pin number, -1 until attached
+
+#if defined(FAST_PIN_REGISTERS)
+    volatile uint32_t* setRegister;   ///< GPIO DR_SET register for the pin's port
+    volatile uint32_t* clearRegister; ///< GPIO DR_CLEAR register for the pin's port
+    uint32_t bitMask;                 ///< The pin's bit within its port
+#endif
+
+    /**
+     * @brief Configures the pin as an output and caches its registers.
+     *
+     * @param pin_number The pin number.
+     */
+    void attach(int pin_number) {
+      pin = pin_number;
+      pinMode(pin, OUTPUT);
+#if defined(FAST_PIN_REGISTERS)
+      setRegister = portSetRegister(pin);
+      clearRegister = portClearRegister(pin);
+      bitMask = digitalPinToBitMask(pin);
+#endif
+    }
+
+    /**
+     * @brief Drives the pin high.
+     */
+    void high() {
+#if defined(FAST_PIN_REGISTERS)
+      *setRegister = bitMask;
+#elif defined(FAST_PIN_MOCK)
+      fastPinMockWrite(pin, true);
+#else
+      digitalWrite(pin, HIGH);
+#endif
+    }
+
+    /**
+     * @brief Drives the pin low.
+     */
+    void low() {
+#if defined(FAST_PIN_REGISTERS)
+      *clearRegister = bitMask;
+#elif defined(FAST_PIN_MOCK)
+      fastPinMockWrite(pin, false);
+#else
+      digitalWrite(pin, LOW);
+#endif
+    }
+
+    /**
+     * @brief Drives the pin to the given level.
+     *
+     * @param value HIGH or LOW.
+     */
+    void write(int value) {
+      if (value) {
+        high();
+      } else {
+        low();
+      }
+    }
+};
+
+#endif // FAST_PIN_H
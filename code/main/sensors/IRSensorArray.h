@@ -13,6 +13,7 @@
 
 #include <Arduino.h>
 #include "ColorSensor.h"
+#include "../controls/DSPKernels.h"
 
 class IRSensorArray {
   private:
@@ -21,9 +22,14 @@ class IRSensorArray {
       int* offValues;
       int* thresholds;
     };
-    const int windowSize = 3;  ///< Moving average window size
-    int** sensorHistory;       ///< Buffer for sensor readings
-    int* historyIndex;         ///< Current index in the buffer
+    const int windowSize = 3;  ///< Moving average window size (window * 1023 must fit an int16)
+    int16_t* sensorHistory;    ///< Buffer for sensor readings, one row of numSensors per slot
+    int16_t* historySums;      ///< Running sum of each sensor's window
+    int16_t* samples;          ///< Latest raw readings
+    int historyIndex;          ///< Slot in the buffer holding the oldest readings
+    int16_t* positionWeights;  ///< Position of each sensor from -1 to 1 in Q14
+    int16_t* weightUnits;      ///< 1 for sensors whose weight counts towards the average
+    int16_t* triggerMask;      ///< 1 for sensors currently triggered
 
   public:
     int numSensors;
@@ -54,11 +60,12 @@ class IRSensorArray {
         delete[] calValues[i].offValues;
         delete[] calValues[i].thresholds;
       }
-      for (int i = 0; i < numSensors; i++) {
-        delete[] sensorHistory[i];
-      }
       delete[] sensorHistory;
-      delete[] historyIndex;
+      delete[] historySums;
+      delete[] samples;
+      delete[] positionWeights;
+      delete[] weightUnits;
+      delete[] triggerMask;
     }
 
     /**
@@ -72,12 +79,18 @@ class IRSensorArray {
         calValues[i].offValues = new int[numSensors];
         calValues[i].thresholds = new int[numSensors];
       }
-      sensorHistory = new int*[numSensors];
-      historyIndex = new int[numSensors];
+      sensorHistory = new int16_t[windowSize * numSensors]();
+      historySums = new int16_t[numSensors]();
+      samples = new int16_t[numSensors]();
+      historyIndex = 0;
 
+      positionWeights = new int16_t[numSensors];
+      weightUnits = new int16_t[numSensors];
+      triggerMask = new int16_t[numSensors]();
       for (int i = 0; i < numSensors; i++) {
-        sensorHistory[i] = new int[windowSize]();
-        historyIndex[i] = 0;
+        positionWeights[i] = (int16_t)lround(
+          (-1 + 2 * ((float)i / (numSensors - 1))) * DSP_WEIGHT_ONE);
+        weightUnits[i] = positionWeights[i] != 0;
       }
 
       for (int i = 0; i < numSensors; i++) {
@@ -95,14 +108,15 @@ class IRSensorArray {
      */
     void readSensors() {
       for (int i = 0; i < numSensors; i++) {
-        sensorHistory[i][historyIndex[i]] = analogRead(sensorPins[i]);
-        historyIndex[i] = (historyIndex[i] + 1) % windowSize;
+        samples[i] = analogRead(sensorPins[i]);
+      }
 
-        int sum = 0;
-        for (int j = 0; j < windowSize; j++) {
-          sum += sensorHistory[i][j];
-        }
-        sensorValues[i] = sum / windowSize;
+      dspMovingAverageUpdate(historySums, sensorHistory + historyIndex * numSensors,
+                             samples, numSensors);
+      historyIndex = (historyIndex + 1) % windowSize;
+
+      for (int i = 0; i < numSensors; i++) {
+        sensorValues[i] = historySums[i] / windowSize;
         sensorTriggers[i] = sensorValues[i] > calValues[currentColor].thresholds[i];
       }
     }
@@ -152,10 +166,8 @@ class IRSensorArray {
      */
     float getError() {
       readSensors();
-      float sumLeftWeight = 0;
-      float sumRightWeight = 0;
-      int countLeftWeight = 0;
-      int countRightWeight = 0;
+      int32_t weightLeft, weightRight;
+      int32_t countLeftWeight, countRightWeight;
       int leftPoint;
       int rightPoint;
 
@@ -168,26 +180,27 @@ class IRSensorArray {
       }
 
       for (int i = 0; i < numSensors; i++) {
-        float weight = (-1 + 2 * ((float)i / (numSensors - 1))) * isSensorTriggered(i);
+        triggerMask[i] = isSensorTriggered(i);
 
         if (debug) {
           Serial.print("Sensor ");
           Serial.print(i);
           Serial.print(": Triggered = ");
-          Serial.print(isSensorTriggered(i));
+          Serial.print(triggerMask[i]);
           Serial.print(", Weight = ");
-          Serial.println(weight);
-        }
-
-        if (i <= leftPoint && weight != 0) {
-          sumLeftWeight += weight;
-          countLeftWeight++;
-        } else if (i >= rightPoint && weight != 0) {
-          sumRightWeight += weight;
-          countRightWeight++;
+          Serial.println(triggerMask[i] * (float)positionWeights[i] / DSP_WEIGHT_ONE);
         }
       }
 
+      // Weighted centroid of each half, the middle sensor of an odd array has no weight
+      dspWeightedCentroid(triggerMask, positionWeights, weightUnits, leftPoint + 1,
+                          weightLeft, countLeftWeight);
+      dspWeightedCentroid(triggerMask + rightPoint, positionWeights + rightPoint,
+                          weightUnits + rightPoint, numSensors - rightPoint,
+                          weightRight, countRightWeight);
+      float sumLeftWeight = (float)weightLeft / DSP_WEIGHT_ONE;
+      float sumRightWeight = (float)weightRight / DSP_WEIGHT_ONE;
+
       float avgLeftWeight = (countLeftWeight > 0) ? (sumLeftWeight / countLeftWeight) : 0;
       float avgRightWeight = (countRightWeight > 0) ? (sumRightWeight / countRightWeight) : 0;
 
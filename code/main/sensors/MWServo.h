@@ -32,42 +32,115 @@ class MWServo {
     float current_angle; ///< Current angle of the servo in degrees.
     float base_angle; ///< Base angle for the servo's zero position.
     float max_angle; ///< Maximum angle the servo can rotate to.
-    const degree angle_step = 0.1; ///< Resolution of angle change per step, affects smoothness.
     const int maxDelayPerAngle = 100; ///< Max delay per angle at lowest speed (ms).
     const int minDelayPerAngle = 5; ///< Min delay per angle at highest speed (ms).
     Servo servo; ///< Servo object to interface with hardware.
 
+    float acceleration = 400; ///< Acceleration and deceleration of profiled moves (deg/s^2).
+    float max_velocity = 0; ///< Cruise velocity of profiled moves (deg/s), 0 to derive it from speed.
+    float target_angle; ///< Angle the profiled move is heading to.
+    float velocity = 0; ///< Current unsigned velocity of the profiled move (deg/s).
+    bool moving = false; ///< True while a profiled move is in progress.
+    int written_angle = -1; ///< Whole degree last sent to the servo, -1 before the first write.
+    unsigned long lastTick; ///< Time of the last profile step (ms).
+
     /**
-     * Writes a given angle to the servo.
+     * Writes a given angle to the servo, cancelling any profiled move.
      * @param angle The angle in degrees to set the servo.
      */
     void write(float angle) {
+        moving = false;
+        velocity = 0;
         current_angle = angle; // Update current angle
-        servo.write(angle); // Command the servo to move to the specified angle
+        target_angle = angle;
+        written_angle = lround(angle); // Rounded the same way as update()
+        servo.write(written_angle); // Command the servo to move to the specified angle
+    }
+
+    /**
+     * Gets the cruise velocity of profiled moves.
+     * @return max_velocity if set, otherwise the pace move() has always used for speed.
+     */
+    float getMaxVelocity() {
+        if (max_velocity > 0) return max_velocity;
+        float percent_speed = speed / 100.0; // Convert speed from percentage to fraction
+        float delayPerAngle = (1 - percent_speed) * (maxDelayPerAngle - minDelayPerAngle) + minDelayPerAngle;
+        return 1000.0 / delayPerAngle;
+    }
+
+    /**
+     * Starts a profiled move to an angle without blocking. Call update() to advance it.
+     * @param angle The target angle in degrees.
+     */
+    void setTargetAngle(degree angle) {
+        target_angle = constrain(angle, min(base_angle, max_angle), max(base_angle, max_angle));
+        if (!moving) {
+            velocity = 0;
+            lastTick = millis();
+        }
+        moving = (target_angle != current_angle);
     }
 
     /**
-     * Moves the servo to a target angle.
+     * Starts a profiled move to a target without blocking. Call update() to advance it.
      * @param targetAngle Target angle as a percentage (0-100) to be mapped to actual angle.
      */
-    void move(int targetAngle) {
-        targetAngle = map(targetAngle, 0, 100, base_angle, max_angle); // Map percentage to angle range
+    void setTarget(int targetAngle) {
+        setTargetAngle(map(targetAngle, 0, 100, base_angle, max_angle)); // Map percentage to angle range
+    }
 
-        float percent_speed = speed / 100.0; // Convert speed from percentage to fraction
+    /**
+     * Advances a profiled move along its trapezoidal velocity profile.
+     *
+     * The servo only resolves whole degrees, so it is only written when the rounded
+     * angle changes.
+     * @param now The current time in ms.
+     * @return True once the move is done.
+     */
+    bool update(unsigned long now) {
+        if (!moving) return true;
+        float dt = (now - lastTick) / 1000.0;
+        lastTick = now;
 
-        unsigned long baseDelay = (unsigned long)((1 - percent_speed) * (maxDelayPerAngle - minDelayPerAngle) + minDelayPerAngle); // Calculate base delay per angle based on speed
-        unsigned long stepDelay = (unsigned long)(baseDelay * angle_step); // Adjust step delay based on angle step
+        float remaining = target_angle - current_angle;
+        float distance = fabs(remaining);
+        // Accelerate up to cruise, but never faster than can stop at the target
+        float stopping = sqrtf(2 * acceleration * distance);
+        velocity = min(min(getMaxVelocity(), stopping), velocity + acceleration * dt);
 
-        if (current_angle < targetAngle) {
-            for (degree angle = current_angle + angle_step; angle <= targetAngle; angle += angle_step) {
-                write(angle); // Write new angle to servo
-                delay(stepDelay); // Delay to pace the movement
-            }
+        float step = velocity * dt;
+        if (step >= distance) {
+            current_angle = target_angle;
+            moving = false;
+            velocity = 0;
         } else {
-            for (degree angle = current_angle - angle_step; angle >= targetAngle; angle -= angle_step) {
-                write(angle); // Write new angle to servo
-                delay(stepDelay); // Delay to pace the movement
-            }
+            current_angle += (remaining > 0) ? step : -step;
+        }
+
+        int whole = lround(current_angle);
+        if (whole != written_angle) {
+            servo.write(whole);
+            written_angle = whole;
+        }
+        return !moving;
+    }
+
+    /**
+     * Checks whether the last profiled move has finished.
+     * @return True if the servo isn't moving.
+     */
+    bool isDone() {
+        return !moving;
+    }
+
+    /**
+     * Moves the servo to a target angle, blocking until it arrives.
+     * @param targetAngle Target angle as a percentage (0-100) to be mapped to actual angle.
+     */
+    void move(int targetAngle) {
+        setTarget(targetAngle);
+        while (!update(millis())) {
+            delay(1); // The servo resolves whole degrees, so there's no need to spin faster
         }
     }
 
@@ -77,6 +150,69 @@ class MWServo {
     void initialize() {
         servo.attach(pin); // Attach the servo object to the specified pin
         servo.write(0); // Set initial servo position to 0 degrees
+        current_angle = 0;
+        target_angle = 0;
+        written_angle = 0;
+        moving = false;
+        lastTick = millis();
+    }
+};
+
+#define SERVO_GROUP_MAX 4 ///< Number of servos a ServoGroup can coordinate.
+
+/**
+ * @class ServoGroup
+ * @brief Runs the profiled moves of several servos at the same time.
+ *
+ * Start each servo's move with setTarget(), then call update() from whatever loop is
+ * running, such as a line following loop, so the servos move while the robot drives.
+ */
+class ServoGroup {
+  public:
+    MWServo* servos[SERVO_GROUP_MAX]; ///< The servos being coordinated.
+    int count = 0; ///< Number of servos added.
+
+    /**
+     * Adds a servo to the group.
+     * @param servo The servo to coordinate.
+     */
+    void add(MWServo& servo) {
+        if (count < SERVO_GROUP_MAX) {
+            servos[count++] = &servo;
+        }
+    }
+
+    /**
+     * Advances every servo's profiled move.
+     * @param now The current time in ms.
+     * @return True once every servo is done.
+     */
+    bool update(unsigned long now) {
+        bool done = true;
+        for (int i = 0; i < count; i++) {
+            done = servos[i]->update(now) && done;
+        }
+        return done;
+    }
+
+    /**
+     * Checks whether every servo has finished its move.
+     * @return True if none of the servos are moving.
+     */
+    bool isDone() {
+        for (int i = 0; i < count; i++) {
+            if (!servos[i]->isDone()) return false;
+        }
+        return true;
+    }
+
+    /**
+     * Blocks until every servo has finished its move.
+     */
+    void wait() {
+        while (!update(millis())) {
+            delay(1);
+        }
     }
 };
 
@@ -13,6 +13,18 @@
 
 #include <Arduino.h>
 #include <vector>
+#include "../controls/CalibrationLookup.h"
+#include "../controls/SlewLimiter.h"
+#include "../controls/VelocityController.h"
+#include "BatteryMonitor.h"
+#include "FastPin.h"
+#include "QuadratureEncoder.h"
+
+// PWM output configuration for the motor enable pins. The Teensy 4.1 FlexPWM timers give
+// 12 bits at 18 kHz, which keeps the L298 switching losses low and is above hearing.
+#define MOTOR_PWM_RESOLUTION 12                          // Bits per analogWrite value
+#define MOTOR_PWM_FREQUENCY 18000                        // Enable pin PWM frequency in Hz
+#define MOTOR_PWM_MAX ((1 << MOTOR_PWM_RESOLUTION) - 1)  // analogWrite value at 100%
 
 // Type definitions for readability
 typedef float percent;
@@ -31,6 +43,7 @@ struct MotorCalibration {
   double speed_percent;
   double pwm_percent; // pwm_percent percentage (0-100)
   double speed;       // Corresponding distance or factor in cm/sec
+  double voltage = 0; // Supply voltage the point was measured at, 0 for the nominal voltage
 };
 
 // Motor class definition
@@ -38,27 +51,51 @@ class Motor {
 public:
   int enPin;                    // Enable pin for motor driver
   int in1Pin, in2Pin;           // Input pins for motor direction control
+  OutputPin in1Output, in2Output; // Direct register access to the direction pins
   bool debug = false;           // Debug flag for additional logging
   const char* label;            // Label for identifying the motor (optional)
   unsigned long lastUpdateTime; // Variable to store the last update time
   MoveType currentMoveType;     // Variable to store the current move type
-  percent currentSpeed;         // Variable to store the current speed percentage
-  float totalDistance;          // Variable to store the total distance driven
+  percent currentSpeed;         // Variable to store the PWM percentage being applied
+  float totalDistance;          // Signed distance driven, positive in the FORWARD direction
+  bool outputsWritten = false;  // False until the pins hold the current direction and PWM
+  int currentPwmOutput;         // PWM value (0-MOTOR_PWM_MAX) last written to the enable pin
 
   std::vector<MotorCalibration> calibrations; // Vector to hold calibration data
+  CalibrationLookup speedFromPwm;             // Compiled pwm_percent -> speed table
+  CalibrationLookup pwmFromSpeedPercent;      // Compiled speed_percent -> pwm_percent table
+  CalibrationLookup pwmFromSpeed;             // Compiled speed (cm/sec) -> pwm_percent table
+
+  QuadratureEncoder* encoder = nullptr;       // Optional wheel encoder, odometry uses it when set
+  VelocityController velocityLoop;            // PI loop used by driveVelocity() with an encoder
+  cm_per_sec targetVelocity = 0;              // Last signed target given to driveVelocity()
+  unsigned long lastVelocityTime = 0;         // Time of the last velocity loop update
+  float calibrationVoltage = 0;               // Voltage of the compiled table rows, 0 for nominal
+  float supply_compensation = 1;              // PWM scale that holds the table's speed on the battery
+  SlewLimiter slew;                           // Acceleration and jerk limits on the PWM
+  bool slew_limited = false;                  // Route drive commands through the slew limiter
+  float slewTarget = 0;                       // Signed PWM percentage requested while slew limited
+  unsigned long lastSlewTime = 0;             // Time of the last slew limiter step
 
   /**
    * @brief Initializes the motor pins and sets initial state to OFF.
    */
   void initialize() {
     pinMode(enPin, OUTPUT);
-    pinMode(in1Pin, OUTPUT);
-    pinMode(in2Pin, OUTPUT);
-    drive(OFF, 0);              // Ensure motor is off at initialization
+    in1Output.attach(in1Pin);
+    in2Output.attach(in2Pin);
+    analogWriteFrequency(enPin, MOTOR_PWM_FREQUENCY);
     lastUpdateTime = millis();  // Initialize last update time
     currentMoveType = OFF;      // Initialize current move type
     currentSpeed = 0;           // Initialize current speed percentage
     totalDistance = 0;          // Initialize total distance driven
+    outputsWritten = false;     // Force the first drive to write every pin
+    velocityLoop.initialize();  // Clear any integral left from a previous run
+    lastVelocityTime = lastUpdateTime;
+    if (encoder != nullptr) {
+      encoder->initialize();
+    }
+    drive(OFF, 0);              // Ensure motor is off at initialization
   }
 
   /**
@@ -69,80 +106,199 @@ public:
   void motorDirection(MoveType move_type) {
     switch (move_type) {
       case OFF:
-        digitalWrite(in1Pin, LOW);
-        digitalWrite(in2Pin, LOW);
+        in1Output.low();
+        in2Output.low();
         break;
       case FORWARD:
-        digitalWrite(in1Pin, LOW);
-        digitalWrite(in2Pin, HIGH);
+        in1Output.low();
+        in2Output.high();
         break;
       case BACKWARD:
-        digitalWrite(in1Pin, HIGH);
-        digitalWrite(in2Pin, LOW);
+        in1Output.high();
+        in2Output.low();
         break;
     }
   }
 
   /**
-   * @brief Sets calibration data for the motor.
+   * @brief Sets calibration data for the motor and compiles the lookup tables.
+   * 
+   * The data may hold one table per supply voltage. Each table's rows share a voltage
+   * and are sorted by increasing PWM. The first table is compiled until
+   * compensateSupply() picks the one closest to the battery.
    * 
    * @param data The calibration data to set.
    */
   void setCalibrationData(const std::vector<MotorCalibration>& data) {
     calibrations = data;
+    compileCalibration(calibrations.empty() ? 0 : calibrations[0].voltage);
+  }
+
+  /**
+   * @brief Compiles the lookup tables from the rows measured at one voltage.
+   * 
+   * @param voltage The voltage of the rows to use, 0 for the nominal voltage.
+   */
+  void compileCalibration(float voltage) {
+    int n = 0;
+    float pwm[CALIBRATION_LOOKUP_MAX_POINTS];
+    float speed[CALIBRATION_LOOKUP_MAX_POINTS];
+    float speed_percent[CALIBRATION_LOOKUP_MAX_POINTS];
+    for (size_t i = 0; i < calibrations.size() && n < CALIBRATION_LOOKUP_MAX_POINTS; ++i) {
+      if ((float)calibrations[i].voltage != voltage) continue;
+      pwm[n] = calibrations[i].pwm_percent;
+      speed[n] = calibrations[i].speed;
+      speed_percent[n] = calibrations[i].speed_percent;
+      n++;
+    }
+    speedFromPwm.build(pwm, speed, n);
+    pwmFromSpeedPercent.build(speed_percent, pwm, n);
+    pwmFromSpeed.build(speed, pwm, n);
+    calibrationVoltage = voltage;
+  }
+
+  /**
+   * @brief Picks the calibration table closest to the battery and scales PWM to match it.
+   * 
+   * @param battery The battery monitor with the latest filtered voltage.
+   */
+  void compensateSupply(BatteryMonitor& battery) {
+    float best = calibrationVoltage;
+    float bestError = fabs((best > 0 ? best : battery.nominal_voltage) - battery.voltage);
+    for (const auto& cal : calibrations) {
+      float voltage = cal.voltage;
+      float error = fabs((voltage > 0 ? voltage : battery.nominal_voltage) - battery.voltage);
+      if (error < bestError) {
+        best = voltage;
+        bestError = error;
+      }
+    }
+    if (best != calibrationVoltage) {
+      compileCalibration(best);
+    }
+    supply_compensation = battery.getCompensation(best > 0 ? best : battery.nominal_voltage);
   }
 
   /**
    * @brief Gets the speed based on the given PWM percentage using linear interpolation.
    * 
+   * Below the first calibration point the motor is in its dead zone and doesn't turn.
+   * Above the last point the final segment is extrapolated.
+   * 
    * @param pwm_percent The PWM percentage.
    * @return The speed in cm/sec.
    */
   float getSpeed(percent pwm_percent) {
-    if (calibrations.empty()) return 1.0;
-
-    for (size_t i = 0; i < calibrations.size() - 1; ++i) {
-      if (pwm_percent >= calibrations[i].pwm_percent && pwm_percent <= calibrations[i + 1].pwm_percent) {
-        double x1 = calibrations[i].pwm_percent;
-        double x2 = calibrations[i + 1].pwm_percent;
-        double y1 = calibrations[i].speed;
-        double y2 = calibrations[i + 1].speed;
-        return y1 + (y2 - y1) * (pwm_percent - x1) / (x2 - x1);
-      }
-    }
-    return 1.0;
+    if (speedFromPwm.empty()) return 1.0;
+    if (pwm_percent < speedFromPwm.minInput()) return 0;
+    return max(speedFromPwm.evaluate(pwm_percent), 0.0f);
   }
 
   /**
    * @brief Gets the PWM percentage based on the given speed percentage using linear interpolation.
    * 
+   * Speeds below the table clamp to the first PWM value, speeds above it extrapolate
+   * the final segment, and the result is always limited to 0-100.
+   * 
    * @param speed_percent The speed percentage.
    * @return The PWM percentage.
    */
   float getPercentPwm(percent speed_percent) {
-    if (calibrations.empty()) return 1.0;
-
-    for (size_t i = 0; i < calibrations.size() - 1; ++i) {
-      if (speed_percent >= calibrations[i].speed_percent && speed_percent <= calibrations[i + 1].speed_percent) {
-        double x1 = calibrations[i].speed_percent;
-        double x2 = calibrations[i + 1].speed_percent;
-        double y1 = calibrations[i].pwm_percent;
-        double y2 = calibrations[i + 1].pwm_percent;
-        return y1 + (y2 - y1) * (speed_percent - x1) / (x2 - x1);
-      }
+    if (pwmFromSpeedPercent.empty()) return 1.0;
+    return constrain(pwmFromSpeedPercent.evaluate(speed_percent), 0.0f, 100.0f);
+  }
+
+  /**
+   * @brief Gets the PWM percentage the calibration table gives for a speed.
+   * 
+   * Speeds below the slowest moving row interpolate down to 0% at 0 cm/sec rather than
+   * clamping to that row, so small corrections stay small instead of jumping to the
+   * dead zone edge. The velocity loop's integral lifts them out of the dead zone when
+   * the wheel has an encoder.
+   * 
+   * @param speed The unsigned speed in cm/sec.
+   * @return The PWM percentage (0-100), 0 for a stopped wheel.
+   */
+  percent getPwmForSpeed(cm_per_sec speed) {
+    if (speed <= 0 || pwmFromSpeed.empty()) return 0;
+    int first = 0;
+    while (first < pwmFromSpeed.count - 1 && pwmFromSpeed.xs[first] <= 0) first++;
+    if (speed < pwmFromSpeed.xs[first]) {
+      return constrain(pwmFromSpeed.ys[first] * speed / pwmFromSpeed.xs[first], 0.0f, 100.0f);
+    }
+    return constrain(pwmFromSpeed.evaluate(speed), 0.0f, 100.0f);
+  }
+
+  /**
+   * @brief Gets the fastest speed the calibration table gives.
+   * 
+   * @return The speed at 100% PWM in cm/sec.
+   */
+  cm_per_sec getMaxSpeed() {
+    return getSpeed(100);
+  }
+
+  /**
+   * @brief Gets the lowest PWM percentage at which the motor turns.
+   * 
+   * @return The first PWM percentage in the calibration table, or 0 without one.
+   */
+  percent getDeadZone() {
+    return speedFromPwm.empty() ? 0 : speedFromPwm.minInput();
+  }
+
+  /**
+   * @brief Converts a PWM percentage into an analogWrite value.
+   * 
+   * @param pwm_percent The PWM percentage (0-100).
+   * @return The value to write at MOTOR_PWM_RESOLUTION bits.
+   */
+  int getPwmOutput(percent pwm_percent) {
+    return lround(constrain(pwm_percent, 0.0f, 100.0f) * MOTOR_PWM_MAX / 100.0f);
+  }
+
+  /**
+   * @brief Gets the signed calibrated velocity of the current command.
+   * 
+   * @return The velocity in cm/sec, positive FORWARD and negative BACKWARD.
+   */
+  cm_per_sec getVelocity() {
+    switch (currentMoveType) {
+      case FORWARD:
+        return getSpeed(currentSpeed);
+      case BACKWARD:
+        return -getSpeed(currentSpeed);
+      default:
+        return 0;
     }
-    return 1.0;
   }
 
   /**
    * @brief Updates the total distance driven based on the current speed and elapsed time.
    */
   void updateDistance() {
-    unsigned long currentTime = millis();
+    updateDistance(millis());
+  }
+
+  /**
+   * @brief Updates the total distance driven up to a given timestamp.
+   * 
+   * @param currentTime The time in milliseconds to integrate up to.
+   */
+  void updateDistance(unsigned long currentTime) {
     unsigned long elapsedTime = currentTime - lastUpdateTime;
-    float speed = getSpeed(currentSpeed);            // Get the current speed in cm/sec
-    totalDistance += (speed * elapsedTime) / 1000.0; // Update the total distance in cm
+    float speed = getVelocity();                     // Get the signed speed in cm/sec
+    float distance = (speed * elapsedTime) / 1000.0; // Distance since the last update in cm
     lastUpdateTime = currentTime;                    // Update the last update time
+
+    if (encoder == nullptr) {
+      totalDistance += distance;
+    } else {
+      if (encoder->simulated) {
+        encoder->simulateDistance(distance);         // A simulated wheel follows its calibration
+      }
+      totalDistance = encoder->getDistance();
+    }
   }
 
   /**
@@ -152,34 +308,151 @@ public:
    * @param speed The speed percentage (0-100).
    */
   void drive(MoveType move_type, percent speed) {
-    updateDistance(); // Update the distance before changing the state
-    int pwm_percent = constrain((255 * speed) / 100, 0, 255);
-    motorDirection(move_type);
-    analogWrite(enPin, pwm_percent);
+    driveAt(move_type, speed, millis());
+  }
+
+  /**
+   * @brief Drives the motor using a timestamp shared with the other motors.
+   * 
+   * With the slew limiter on, the command becomes its target and the PWM moves towards
+   * it within the limits. Otherwise it is written straight away.
+   * 
+   * @param move_type The movement type (OFF, FORWARD, BACKWARD).
+   * @param speed The speed percentage (0-100).
+   * @param currentTime The time in milliseconds the command takes effect.
+   */
+  void driveAt(MoveType move_type, percent speed, unsigned long currentTime) {
+    if (slew_limited) {
+      slewTarget = (move_type == FORWARD) ? speed : (move_type == BACKWARD) ? -speed : 0;
+      updateSlew(currentTime);
+      return;
+    }
+    writeOutput(move_type, speed, currentTime);
+  }
+
+  /**
+   * @brief Turns the slew limiter on or off.
+   * 
+   * The limiter starts from the PWM already applied. Turning it off applies the last
+   * requested PWM straight away.
+   * 
+   * @param enabled True to limit acceleration and jerk.
+   */
+  void setSlewLimited(bool enabled) {
+    if (enabled == slew_limited) return;
+    unsigned long now = millis();
+    float applied = (currentMoveType == FORWARD) ? currentSpeed : (currentMoveType == BACKWARD) ? -currentSpeed : 0;
+    if (enabled) {
+      slew.initialize(applied);
+      slewTarget = applied;
+      lastSlewTime = now;
+      slew_limited = true;
+    } else {
+      slew_limited = false;
+      writeOutput((slewTarget > 0) ? FORWARD : (slewTarget < 0) ? BACKWARD : OFF, fabs(slewTarget), now);
+    }
+  }
+
+  /**
+   * @brief Steps the slew limiter towards the last requested PWM.
+   * 
+   * Runs from every drive command. Loops that hold a command without re-sending it
+   * should call it every iteration so the ramp keeps moving.
+   * 
+   * @param currentTime The current time in milliseconds.
+   */
+  void updateSlew(unsigned long currentTime) {
+    if (!slew_limited) return;
+    float dt = (currentTime - lastSlewTime) / 1000.0;
+    lastSlewTime = currentTime;
+    float output = slew.update(slewTarget, dt);
+    writeOutput((output > 0) ? FORWARD : (output < 0) ? BACKWARD : OFF, fabs(output), currentTime);
+  }
+
+  /**
+   * @brief Writes a direction and PWM percentage to the pins.
+   * 
+   * Distance is integrated up to the timestamp before the state changes. The direction
+   * pins and the PWM are only written when their values differ from what the pins
+   * already hold.
+   * 
+   * @param move_type The movement type (OFF, FORWARD, BACKWARD).
+   * @param speed The speed percentage (0-100).
+   * @param currentTime The time in milliseconds the command takes effect.
+   */
+  void writeOutput(MoveType move_type, percent speed, unsigned long currentTime) {
+    updateDistance(currentTime); // Update the distance before changing the state
+    int pwm_output = getPwmOutput(speed * supply_compensation);
+    if (!outputsWritten || move_type != currentMoveType) {
+      motorDirection(move_type);
+    }
+    if (!outputsWritten || pwm_output != currentPwmOutput) {
+      analogWrite(enPin, pwm_output);
+    }
+    outputsWritten = true;
+    currentPwmOutput = pwm_output;
     currentMoveType = move_type; // Store the current move type
-    currentSpeed = getSpeed(pwm_percent); // Store the current speed percentage
+    // Store the applied PWM percentage as its equivalent at the table's voltage
+    currentSpeed = 100.0f * pwm_output / MOTOR_PWM_MAX / supply_compensation;
+  }
+
+  /**
+   * @brief Drives the wheel at a signed velocity.
+   * 
+   * The calibration table gives the feedforward PWM. With an encoder attached, the PI
+   * loop corrects it from the measured velocity, so the speed holds under load. Without
+   * one, this is open loop on the calibration. Call it every loop iteration.
+   * 
+   * @param velocity The target in cm/sec, positive FORWARD.
+   * @param currentTime The time in milliseconds the command takes effect.
+   */
+  void driveVelocity(cm_per_sec velocity, unsigned long currentTime) {
+    targetVelocity = velocity;
+    percent feedforward = getPwmForSpeed(fabs(velocity));
+    float signed_pwm = (velocity >= 0) ? feedforward : -feedforward;
+
+    if (encoder != nullptr) {
+      float dt = (currentTime - lastVelocityTime) / 1000.0;
+      cm_per_sec measured = encoder->updateVelocity(currentTime);
+      signed_pwm = velocityLoop.compute(velocity, measured, feedforward, dt);
+    }
+    lastVelocityTime = currentTime;
+
+    if (signed_pwm > 0) {
+      driveAt(FORWARD, signed_pwm, currentTime);
+    } else if (signed_pwm < 0) {
+      driveAt(BACKWARD, -signed_pwm, currentTime);
+    } else {
+      driveAt(OFF, 0, currentTime);
+    }
+  }
+
+  /**
+   * @brief Drives the wheel at a signed velocity.
+   * 
+   * @param velocity The target in cm/sec, positive FORWARD.
+   */
+  void driveVelocity(cm_per_sec velocity) {
+    driveVelocity(velocity, millis());
   }
 
   /**
    * @brief Drives the motor with a specific speed percentage.
    * 
+   * Any speed above zero maps into the calibrated band above the dead zone, so the
+   * whole PWM resolution is spent on speeds the motor can actually produce.
+   * 
    * @param move_type The movement type (OFF, FORWARD, BACKWARD).
    * @param speed The speed percentage (0-100).
    */
   void driveSpeed(MoveType move_type, percent speed) {
-    updateDistance(); // Update the distance before changing the state
-    float calibrationFactor = getPercentPwm(speed);
-    int pwm_percent = constrain((255 * calibrationFactor) / 100, 0, 255);
-    motorDirection(move_type);
-    analogWrite(enPin, pwm_percent);
-    currentMoveType = move_type; // Store the current move type
-    currentSpeed = getSpeed(pwm_percent); // Store the current speed percentage
+    drive(move_type, (speed > 0) ? getPercentPwm(speed) : 0);
   }
 
   /**
    * @brief Gets the total distance driven.
    * 
-   * @return The total distance in cm.
+   * @return The signed total distance in cm, positive FORWARD.
    */
   float getTotalDistance() const {
     return totalDistance;
@@ -197,4 +470,68 @@ public:
   }
 };
 
+/**
+ * @brief Runs a wheel's velocity loop against a simulated loaded wheel and prints the result.
+ *
+ * Nothing is written to the motor's pins. The motor's calibration table is the plant: a
+ * simulated encoder is fed the speed the table gives for each PWM, scaled down by load,
+ * on a 10 ms step clock rather than real time. Open loop, the wheel would only reach
+ * load times the target; the loop has to find the extra PWM. It runs in a few
+ * milliseconds, on the robot or in a host build (uncomment its line in setup()).
+ *
+ * @param motor The motor whose calibration table and loop gains are checked.
+ * @param target The target velocity in cm/sec.
+ * @param load The fraction of the table's speed the loaded wheel reaches.
+ * @return True if the wheel holds within 10% of the target by the end of 3 seconds.
+ */
+bool velocityLoopCheck(Motor& motor, cm_per_sec target = 20, float load = 0.7) {
+  const unsigned long step = 10;     // Simulated loop period in ms
+  const unsigned long duration = 3000;
+  QuadratureEncoder wheel;
+  if (motor.encoder != nullptr) wheel = *motor.encoder;  // Same resolution and period
+  else wheel.counts_per_cm = 47.3;                        // 1425.1 counts/rev on a 96 mm omni wheel
+  wheel.simulated = true;
+  wheel.simulated_load = load;
+  wheel.initialize();
+  VelocityController loop = motor.velocityLoop;  // Same gains, fresh integral
+  loop.initialize();
+
+  percent feedforward = motor.getPwmForSpeed(target);
+  float signed_pwm = 0;
+  cm_per_sec measured = 0;
+  unsigned long settled_time = 0;    // Start of the current run inside the band, 0 if outside
+  unsigned long start = wheel.lastTime;
+  for (unsigned long now = start + step; now - start <= duration; now += step) {
+    float speed = motor.getSpeed(fabs(signed_pwm));
+    wheel.simulateDistance(((signed_pwm >= 0) ? speed : -speed) * step / 1000.0);
+    measured = wheel.updateVelocity(now);
+    signed_pwm = loop.compute(target, measured, feedforward, step / 1000.0);
+    if (fabs(measured - target) > 0.1 * fabs(target)) {
+      settled_time = 0;
+    } else if (settled_time == 0) {
+      settled_time = now;
+    }
+  }
+
+  Serial.print("== Velocity loop check: ");
+  Serial.print(motor.label);
+  Serial.print(" | Target: ");
+  Serial.print(target);
+  Serial.print(" cm/s | Open loop: ");
+  Serial.print(target * load);
+  Serial.print(" cm/s | Closed loop: ");
+  Serial.print(measured);
+  Serial.print(" cm/s at ");
+  Serial.print(signed_pwm);
+  Serial.print("% PWM | ");
+  if (settled_time == 0) {
+    Serial.println("did not settle");
+  } else {
+    Serial.print("settled in ");
+    Serial.print(settled_time - start);
+    Serial.println(" ms");
+  }
+  return settled_time != 0;
+}
+
 #endif // MOTOR_H
@@ -0,0 +1,148 @@
+/**
+ * @file QuadratureEncoder.h
+ * @brief Defines the QuadratureEncoder class for reading a motor's hall effect encoder.
+ *
+ * This file contains the definition of the QuadratureEncoder class, which counts the A/B
+ * edges of a quadrature encoder in pin change interrupts. The ISR is the only writer of
+ * the 32-bit count, and an aligned 32-bit load is atomic on the Cortex-M7, so the main
+ * loop can read it without disabling interrupts. A simulated encoder skips the
+ * interrupts and is fed distances by its Motor, so the velocity loop can run on the host.
+ * Those distances come from the same calibration table as the feedforward, so on its own
+ * the loop only sees an error where the table says the wheel stalls (inside the dead
+ * zone). simulated_load scales them down to stand in for a loaded wheel, which gives the
+ * loop a real error to remove; velocityLoopCheck() in Motor.h runs that case.
+ */
+
+#ifndef QUADRATURE_ENCODER_H
+#define QUADRATURE_ENCODER_H
+
+#include <Arduino.h>
+
+#define QUADRATURE_ENCODER_MAX 4 ///< Number of encoders that can have interrupts attached.
+
+class QuadratureEncoder;
+
+/**
+ * @brief Returns the encoder attached to each interrupt slot.
+ */
+QuadratureEncoder** quadratureEncoderSlots() {
+  static QuadratureEncoder* slots[QUADRATURE_ENCODER_MAX] = {nullptr};
+  return slots;
+}
+
+class QuadratureEncoder {
+  public:
+    int pinA = -1;                ///< Pin connected to encoder channel A.
+    int pinB = -1;                ///< Pin connected to encoder channel B.
+    float counts_per_cm = 1;      ///< Counts (all four edges) per cm of wheel travel.
+    bool invert = false;          ///< Flip the sign so FORWARD counts up.
+    bool simulated = false;       ///< Skip the hardware and count simulateDistance() instead.
+    float simulated_load = 1;     ///< Fraction of each simulated distance the wheel travels, below 1 when loaded.
+    unsigned long velocity_period = 20; ///< Minimum time between velocity estimates in ms.
+
+    volatile int32_t count = 0;   ///< Edge count, written only by the ISR.
+    volatile uint8_t state = 0;   ///< Last A/B levels, written only by the ISR.
+    int32_t lastCount = 0;        ///< Count at the last velocity estimate.
+    unsigned long lastTime = 0;   ///< Time of the last velocity estimate.
+    float velocity = 0;           ///< Latest velocity estimate in cm/sec.
+    float simulatedRemainder = 0; ///< Fraction of a count carried between simulated steps.
+
+    /**
+     * @brief Sets up the pins and attaches the interrupts.
+     *
+     * @return False if every interrupt slot is already used.
+     */
+    bool initialize() {
+      count = 0;
+      lastCount = 0;
+      lastTime = millis();
+      velocity = 0;
+      if (simulated) return true;
+
+      int slot = 0;
+      QuadratureEncoder** slots = quadratureEncoderSlots();
+      while (slot < QUADRATURE_ENCODER_MAX && slots[slot] != nullptr && slots[slot] != this) {
+        slot++;
+      }
+      if (slot == QUADRATURE_ENCODER_MAX) return false;
+      slots[slot] = this;
+
+      pinMode(pinA, INPUT_PULLUP);
+      pinMode(pinB, INPUT_PULLUP);
+      state = (digitalRead(pinA) << 1) | digitalRead(pinB);
+      attachInterrupt(digitalPinToInterrupt(pinA), isrFor(slot), CHANGE);
+      attachInterrupt(digitalPinToInterrupt(pinB), isrFor(slot), CHANGE);
+      return true;
+    }
+
+    /**
+     * @brief Decodes one edge. Runs in interrupt context.
+     */
+    void handleEdge() {
+      // Index is (previous AB << 2) | current AB, invalid double steps count as zero
+      static const int8_t transitions[16] = {
+        0, -1, 1, 0,
+        1, 0, 0, -1,
+        -1, 0, 0, 1,
+        0, 1, -1, 0,
+      };
+      uint8_t current = (digitalReadFast(pinA) << 1) | digitalReadFast(pinB);
+      count = count + transitions[(state << 2) | current];
+      state = current;
+    }
+
+    /**
+     * @brief Advances a simulated encoder by a distance.
+     *
+     * @param distance The signed wheel travel in cm.
+     */
+    void simulateDistance(float distance) {
+      float counts = distance * simulated_load * counts_per_cm * (invert ? -1 : 1) + simulatedRemainder;
+      int32_t whole = (int32_t)counts;
+      simulatedRemainder = counts - whole;
+      count = count + whole;
+    }
+
+    /**
+     * @brief Gets the signed wheel travel since initialization.
+     *
+     * @return The distance in cm, positive FORWARD.
+     */
+    float getDistance() const {
+      int32_t counts = count;
+      return (invert ? -counts : counts) / counts_per_cm;
+    }
+
+    /**
+     * @brief Updates the velocity estimate once velocity_period has passed.
+     *
+     * @param now The current time in ms.
+     * @return The latest signed velocity in cm/sec.
+     */
+    float updateVelocity(unsigned long now) {
+      unsigned long elapsed = now - lastTime;
+      if (elapsed < velocity_period) return velocity;
+
+      int32_t counts = count;
+      int32_t delta = invert ? lastCount - counts : counts - lastCount;
+      velocity = (delta / counts_per_cm) * 1000.0 / elapsed;
+      lastCount = counts;
+      lastTime = now;
+      return velocity;
+    }
+
+  private:
+    template <int SLOT>
+    static void isr() {
+      quadratureEncoderSlots()[SLOT]->handleEdge();
+    }
+
+    static void (*isrFor(int slot))() {
+      static void (*const handlers[QUADRATURE_ENCODER_MAX])() = {
+        isr<0>, isr<1>, isr<2>, isr<3>,
+      };
+      return handlers[slot];
+    }
+};
+
+#endif // QUADRATURE_ENCODER_H
@@ -0,0 +1,278 @@
+/**
+ * @file SonarManager.h
+ * @brief Defines the SonarManager class for ranging with several HC-SR04 sensors in the background.
+ *
+ * This file contains the definition of the SonarManager class, which fires the ultrasonic
+ * sensors one after another from a timer and times their echo pulses in pin change
+ * interrupts. UltraSonic::getDistance() blocks for a 10 ms settle delay plus the whole
+ * echo, up to 6 ms per reading at 1 m, and the three sensors are read back to back in
+ * most loops. Once managed, getDistance() returns the latest published range instead,
+ * so control loops never wait on the sound.
+ *
+ * The sensors all face the same way, so they are fired strictly in turn with a settle
+ * time between pings, and one sensor never hears another's echo. The cycle is
+ * (echo time + settle_time) per sensor, about 12 ms each at 1 m.
+ *
+ * Host builds have no timer, so tick() is called by hand. A simulated manager skips the
+ * pins and publishes the ranges given to simulateEcho() when each sensor is fired.
+ */
+
+#ifndef SONAR_MANAGER_H
+#define SONAR_MANAGER_H
+
+#include <Arduino.h>
+#include "UltraSonic.h"
+
+#define SONAR_MANAGER_MAX 3 ///< Number of sensors a SonarManager can fire.
+
+class SonarManager;
+
+/**
+ * @brief Returns the manager whose interrupts are attached.
+ */
+SonarManager*& sonarManagerTarget() {
+  static SonarManager* target = nullptr;
+  return target;
+}
+
+/**
+ * @enum SonarPhase
+ * @brief Where the manager is in the current sensor's ping.
+ */
+enum SonarPhase {
+  SONAR_SETTLE,    ///< Waiting for the last ping's echoes to die out.
+  SONAR_WAIT_ECHO, ///< Triggered, waiting for the echo pin to go high.
+  SONAR_ECHO_HIGH, ///< Echo pin is high, timing the pulse.
+};
+
+class SonarManager {
+  public:
+    float max_range = 200;                ///< Echoes longer than this are reported as out of range, in cm.
+    unsigned long settle_time = 6000;     ///< Quiet time between pings in microseconds.
+    unsigned long echo_start_timeout = 2000; ///< Longest wait for the echo pulse to begin in microseconds.
+    unsigned long tick_period = 250;      ///< Timer period in microseconds on the Teensy.
+    bool simulated = false;               ///< Skip the pins and publish simulateEcho() ranges instead.
+
+    UltraSonic* sonars[SONAR_MANAGER_MAX]; ///< The sensors, fired in the order they were added.
+    int count = 0;                         ///< Number of sensors added.
+    float simulatedRange[SONAR_MANAGER_MAX]; ///< Range each simulated sensor reports in cm.
+
+    volatile int current = 0;                  ///< Index of the sensor being fired.
+    volatile SonarPhase phase = SONAR_SETTLE;  ///< Where the current ping is.
+    volatile unsigned long phaseStart = 0;     ///< micros() when the phase began.
+    volatile unsigned long echoStart = 0;      ///< micros() at the rising edge of the echo.
+    volatile uint32_t timeouts = 0;            ///< Pings with no echo within max_range.
+
+    /**
+     * @brief Adds a sensor to the firing sequence.
+     *
+     * The sensor's pins must already be set up with UltraSonic::initialize().
+     *
+     * @param sonar The sensor to fire.
+     * @return False if the manager is full.
+     */
+    bool add(UltraSonic& sonar) {
+      if (count >= SONAR_MANAGER_MAX) return false;
+      simulatedRange[count] = max_range;
+      sonars[count++] = &sonar;
+      return true;
+    }
+
+    /**
+     * @brief Attaches the echo interrupts, starts the timer, and waits for a first reading.
+     *
+     * After this every added sensor is managed, so its getDistance() stops pinging.
+     */
+    void begin() {
+      sonarManagerTarget() = this;
+      current = 0;
+      phase = SONAR_SETTLE;
+      phaseStart = micros();
+
+      for (int i = 0; i < count; i++) {
+        if (!simulated) {
+          attachInterrupt(digitalPinToInterrupt(sonars[i]->echoPin), echoIsrFor(i), CHANGE);
+        }
+        sonars[i]->managed = true;
+      }
+
+#if defined(__IMXRT1062__)
+      if (!simulated) timer.begin(timerIsr, tick_period);
+#endif
+
+      // Every sensor has a range before anything reads it
+      unsigned long start = millis();
+      while (!ready() && millis() - start < 500) {
+        poll();
+      }
+    }
+
+    /**
+     * @brief Advances the firing sequence. Runs from the timer on the Teensy.
+     *
+     * Fires the next sensor once the settle time has passed, and reports a sensor as out
+     * of range if its echo doesn't start, or doesn't end, in time.
+     */
+    void tick() {
+      if (count == 0) return;
+      unsigned long now = micros();
+      unsigned long elapsed = now - phaseStart;
+
+      switch (phase) {
+        case SONAR_SETTLE:
+          if (elapsed >= settle_time) fire(now);
+          break;
+        case SONAR_WAIT_ECHO:
+          if (elapsed >= echo_start_timeout) finish(max_range, false, now);
+          break;
+        case SONAR_ECHO_HIGH:
+          if (now - echoStart > maxEchoTime()) finish(max_range, false, now);
+          break;
+      }
+    }
+
+    /**
+     * @brief Calls tick() where there is no timer to do it.
+     */
+    void poll() {
+#if defined(__IMXRT1062__)
+      if (!simulated) return;
+#endif
+      tick();
+    }
+
+    /**
+     * @brief Handles an edge on the current sensor's echo pin. Runs in interrupt context.
+     *
+     * @param index The sensor whose echo pin changed.
+     */
+    void handleEcho(int index) {
+      if (index != current) return; // Only one sensor is pinging at a time
+      unsigned long now = micros();
+      bool level = digitalReadFast(sonars[index]->echoPin);
+
+      if (level && phase == SONAR_WAIT_ECHO) {
+        echoStart = now;
+        phase = SONAR_ECHO_HIGH;
+      } else if (!level && phase == SONAR_ECHO_HIGH) {
+        unsigned long duration = now - echoStart;
+        if (duration > maxEchoTime()) {
+          finish(max_range, false, now);
+        } else {
+          finish(duration * 0.034 / 2, true, now);
+        }
+      }
+    }
+
+    /**
+     * @brief Sets the range a simulated sensor reports.
+     *
+     * @param index The sensor, in the order it was added.
+     * @param range The range in cm.
+     */
+    void simulateEcho(int index, float range) {
+      if (index >= 0 && index < count) simulatedRange[index] = range;
+    }
+
+    /**
+     * @brief Checks that every sensor has published at least one reading.
+     */
+    bool ready() const {
+      for (int i = 0; i < count; i++) {
+        if (sonars[i]->readings == 0) return false;
+      }
+      return true;
+    }
+
+    /**
+     * @brief Prints the latest range and age of each sensor to the serial monitor.
+     */
+    void printout() {
+      for (int i = 0; i < count; i++) {
+        float range;
+        unsigned long age;
+        bool valid;
+        sonars[i]->getLatest(range, age, valid);
+        Serial.print(sonars[i]->label);
+        Serial.print(": ");
+        Serial.print(range);
+        Serial.print(valid ? " cm | Age: " : " cm (no echo) | Age: ");
+        Serial.print(age);
+        Serial.println(" ms");
+      }
+      Serial.print("Timeouts: ");
+      Serial.println(timeouts);
+    }
+
+    /**
+     * @brief Longest time to fire every sensor once, in milliseconds.
+     *
+     * Each sensor takes up to settle_time, echo_start_timeout and the longest echo, so a
+     * reading can be up to this old when the next one for the same sensor arrives.
+     */
+    unsigned long cycleTime() const {
+      return (count * (settle_time + echo_start_timeout + maxEchoTime()) + 999) / 1000;
+    }
+
+  private:
+#if defined(__IMXRT1062__)
+    IntervalTimer timer; ///< Calls tick() every tick_period.
+#endif
+
+    /**
+     * @brief Longest echo pulse inside max_range in microseconds.
+     */
+    unsigned long maxEchoTime() const {
+      return max_range * 2 / 0.034;
+    }
+
+    /**
+     * @brief Sends the trigger pulse for the current sensor.
+     */
+    void fire(unsigned long now) {
+      UltraSonic* sonar = sonars[current];
+      if (simulated) {
+        phaseStart = now;
+        phase = SONAR_WAIT_ECHO;
+        finish(simulatedRange[current], simulatedRange[current] < max_range, now);
+        return;
+      }
+
+      sonar->trigOutput.low();
+      delayMicroseconds(2);
+      sonar->trigOutput.high();
+      delayMicroseconds(sonar->soundDelay);
+      sonar->trigOutput.low();
+      phaseStart = micros();
+      phase = SONAR_WAIT_ECHO;
+    }
+
+    /**
+     * @brief Publishes the current sensor's range and moves on to the next sensor.
+     */
+    void finish(float range, bool valid, unsigned long now) {
+      if (!valid) timeouts = timeouts + 1;
+      sonars[current]->publish(range, millis(), valid);
+      current = (current + 1) % count;
+      phase = SONAR_SETTLE;
+      phaseStart = now;
+    }
+
+    template <int INDEX>
+    static void echoIsr() {
+      sonarManagerTarget()->handleEcho(INDEX);
+    }
+
+    static void timerIsr() {
+      sonarManagerTarget()->tick();
+    }
+
+    static void (*echoIsrFor(int index))() {
+      static void (*const handlers[SONAR_MANAGER_MAX])() = {
+        echoIsr<0>, echoIsr<1>, echoIsr<2>,
+      };
+      return handlers[index];
+    }
+};
+
+#endif // SONAR_MANAGER_H
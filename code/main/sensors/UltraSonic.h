@@ -14,6 +14,8 @@
 #define ULTRASONIC_H
 
 #include <Arduino.h>
+#include "FastPin.h"
+#include "../controls/RangeFilter.h"
 
 /**
  * @class UltraSonic
@@ -27,15 +29,26 @@ class UltraSonic {
   public:
     int echoPin; ///< Pin connected to the echo pin of the sensor.
     int trigPin; ///< Pin connected to the trigger pin of the sensor.
+    OutputPin trigOutput; ///< Direct register access to the trigger pin.
     const char* label; ///< Optional label for identifying the sensor.
     int soundDelay; ///< Delay in microseconds between trigger and echo, affecting pulse frequency.
     float distance; ///< Last calculated distance from the sensor in centimeters.
 
+    bool managed = false; ///< True once a SonarManager fires this sensor in the background.
+    volatile float latest_range = 0; ///< Range published by the last measurement, in cm.
+    volatile unsigned long latest_time = 0; ///< millis() when latest_range was measured.
+    volatile bool latest_valid = false; ///< False if the last ping had no echo within max_range.
+    volatile uint32_t readings = 0; ///< Number of measurements published.
+    uint32_t cache_hits = 0; ///< getDistance(maxAgeMs) calls answered by the latest reading.
+    uint32_t cache_misses = 0; ///< getDistance(maxAgeMs) calls that needed a new measurement.
+    RangeFilter filter; ///< Median and Kalman filter over the readings.
+    uint32_t filtered_readings = 0; ///< Value of readings when the filter last took one.
+
     /**
      * Initializes the sensor pins.
      */
     void initialize() {
-        pinMode(trigPin, OUTPUT); // Set trigger pin as output
+        trigOutput.attach(trigPin); // Set trigger pin as output
         pinMode(echoPin, INPUT);  // Set echo pin as input
     }
 
@@ -46,12 +59,12 @@ class UltraSonic {
     float getDuration() {
         delay(10); // Ensures there's no carryover from previous pulses
 
-        digitalWrite(trigPin, LOW); // Clear the trigger pin
+        trigOutput.low(); // Clear the trigger pin
         delayMicroseconds(5); // Short delay before sending the pulse
 
-        digitalWrite(trigPin, HIGH); // Send a high pulse
+        trigOutput.high(); // Send a high pulse
         delayMicroseconds(soundDelay); // Wait for soundDelay microseconds
-        digitalWrite(trigPin, LOW); // End the pulse
+        trigOutput.low(); // End the pulse
 
         float sound_duration = pulseIn(echoPin, HIGH); // Measure the length of the incoming pulse
 
@@ -60,13 +73,146 @@ class UltraSonic {
 
     /**
      * Calculates and returns the distance to the nearest object.
+     *
+     * A managed sensor returns the latest background measurement instead of pinging,
+     * so the result is at most one SonarManager cycle old.
      * @return Distance to the nearest object in centimeters.
      */
     float getDistance() {
-        distance = getDuration() * 0.034 / 2; // Convert time to distance
+        if (managed) {
+            unsigned long age;
+            bool valid;
+            getLatest(distance, age, valid);
+            return distance;
+        }
+        float duration = getDuration();
+        distance = duration * 0.034 / 2; // Convert time to distance
+        publish(distance, millis(), duration > 0);
         return distance;
     }
 
+    /**
+     * Returns the latest range if it is recent enough, otherwise measures a new one.
+     *
+     * Lets a control cycle ask about the same sensor several times for the cost of one
+     * measurement. A managed sensor never pings or waits: on a miss it still returns its
+     * latest reading. Callers that must act on a new reading check readings, or call
+     * waitForReading() first.
+     * @param maxAgeMs Oldest reading to reuse, in milliseconds.
+     * @return Distance to the nearest object in centimeters.
+     */
+    float getDistance(unsigned long maxAgeMs) {
+        float range;
+        unsigned long age;
+        bool valid;
+        uint32_t count = getLatest(range, age, valid);
+        if (count > 0 && age <= maxAgeMs) {
+            cache_hits++;
+            distance = range;
+            return distance;
+        }
+
+        cache_misses++;
+        if (!managed) return getDistance();
+        if (count > 0) distance = range;
+        return distance;
+    }
+
+    /**
+     * Waits for a reading newer than the latest one.
+     *
+     * An unmanaged sensor pings straight away. A managed one blocks until the SonarManager
+     * publishes, which can take up to a manager cycle.
+     * @param timeoutMs Longest time to wait, in milliseconds.
+     * @return True if a new reading arrived.
+     */
+    bool waitForReading(unsigned long timeoutMs) {
+        if (!managed) {
+            getDistance();
+            return true;
+        }
+        uint32_t seen = readings;
+        unsigned long start = millis();
+        while (readings == seen) {
+            if (millis() - start >= timeoutMs) return false;
+        }
+        return true;
+    }
+
+    /**
+     * Returns the filtered range, feeding the filter any reading it hasn't seen yet.
+     *
+     * Check filter.valid to see whether the latest reading was accepted, and filter.rate
+     * for the range rate.
+     * @param maxAgeMs Oldest reading to reuse, in milliseconds.
+     * @return Filtered distance to the nearest object in centimeters.
+     */
+    float getFilteredDistance(unsigned long maxAgeMs) {
+        getDistance(maxAgeMs);
+        if (readings != filtered_readings) {
+            filtered_readings = readings;
+            filter.update(distance, latest_time);
+        }
+        return filter.range;
+    }
+
+    /**
+     * Clears the cache hit and miss counters.
+     */
+    void resetCacheStats() {
+        cache_hits = 0;
+        cache_misses = 0;
+    }
+
+    /**
+     * Prints the cache hits and misses since the last reset to the serial monitor.
+     */
+    void printCacheStats() {
+        Serial.print(label);
+        Serial.print(" | Hits: ");
+        Serial.print(cache_hits);
+        Serial.print(" | Misses: ");
+        Serial.println(cache_misses);
+    }
+
+    /**
+     * Records a measurement. Called from the SonarManager's interrupts when managed.
+     * @param range The range in centimeters.
+     * @param time millis() at the measurement.
+     * @param valid False if there was no echo within max_range.
+     */
+    void publish(float range, unsigned long time, bool valid) {
+        latest_range = range;
+        latest_time = time;
+        latest_valid = valid;
+        readings = readings + 1;
+    }
+
+    /**
+     * Reads the latest measurement consistently, even while interrupts publish new ones.
+     * @param range Set to the range in centimeters.
+     * @param age Set to the age of the measurement in milliseconds.
+     * @param valid Set to false if there was no echo within max_range.
+     * @return The number of measurements published so far, to tell new ones apart.
+     */
+    uint32_t getLatest(float& range, unsigned long& age, bool& valid) {
+        noInterrupts();
+        range = latest_range;
+        unsigned long time = latest_time;
+        valid = latest_valid;
+        uint32_t count = readings;
+        interrupts();
+        age = millis() - time;
+        return count;
+    }
+
+    /**
+     * Gets the time of the latest measurement.
+     * @return millis() when the latest range was measured.
+     */
+    unsigned long getReadingTime() {
+        return latest_time;
+    }
 };
 
 #endif // ULTRASONIC_H